@@ -66,6 +66,7 @@
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
 
 /*
  * The top of user space. (Actually, the address immediately above the
@@ -110,9 +111,11 @@ void ram_getsize(paddr_t *lo, paddr_t *hi);
 
 struct tlbshootdown {
 	/*
-	 * Change this to what you need for your VM design.
+	 * TLB entries are tagged with an address space ID, so that is
+	 * what identifies the mapping; no pointer to the addrspace is
+	 * needed on the receiving side.
 	 */
-	struct addrspace *ts_addrspace;
+	unsigned ts_asid;
 	vaddr_t ts_vaddr;
 };
 
@@ -30,13 +30,266 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
+#include <kern/syscallstat.h>
 #include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
 
 #include "opt-A2.h"
+#include "opt-A3.h"
+
+/*
+ * Argument marshalling: one small function per system call that pulls
+ * its arguments out of the trapframe and calls the real handler.
+ */
+
+static
+int
+sc_reboot(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_reboot(tf->tf_a0);
+}
+
+static
+int
+sc___time(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+#ifdef UW
+static
+int
+sc_write(struct trapframe *tf, int32_t *retval)
+{
+	return sys_write((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc__exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys__exit((int)tf->tf_a0);
+	/* sys__exit does not return, execution should not get here */
+	panic("unexpected return from sys__exit");
+	return 0;
+}
+
+static
+int
+sc_getpid(struct trapframe *tf, int32_t *retval)
+{
+	(void)tf;
+	return sys_getpid((pid_t *)retval);
+}
+
+static
+int
+sc_waitpid(struct trapframe *tf, int32_t *retval)
+{
+	return sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2, (pid_t *)retval);
+}
+#endif /* UW */
+
+#if OPT_A2
+static
+int
+sc_fork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_fork(tf, (pid_t *)retval);
+}
+
+static
+int
+sc_execv(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_execv((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_open(struct trapframe *tf, int32_t *retval)
+{
+	return sys_open((const_userptr_t)tf->tf_a0, (int)tf->tf_a1,
+			(mode_t)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_read(struct trapframe *tf, int32_t *retval)
+{
+	return sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			(size_t)tf->tf_a2, (int *)retval);
+}
+
+/*
+ * lseek(int fd, off_t pos, int whence): POS is 64-bit, so it takes the
+ * aligned a2/a3 pair and WHENCE is on the user stack. The result is
+ * 64-bit too; the high half goes back in v0 and the low half in v1.
+ */
+static
+int
+sc_lseek(struct trapframe *tf, int32_t *retval)
+{
+	off_t pos, newpos;
+	int whence, result;
+
+	pos = ((off_t)tf->tf_a2 << 32) | (uint32_t)tf->tf_a3;
+	result = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+			sizeof(whence));
+	if (result) {
+		return result;
+	}
+	result = sys_lseek((int)tf->tf_a0, pos, whence, &newpos);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)(newpos >> 32);
+	tf->tf_v1 = (uint32_t)newpos;
+	return 0;
+}
+
+static
+int
+sc_close(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_close((int)tf->tf_a0);
+}
+
+static
+int
+sc_dup2(struct trapframe *tf, int32_t *retval)
+{
+	return sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, (int *)retval);
+}
+
+static
+int
+sc_ioctl(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_ioctl((int)tf->tf_a0, (int)tf->tf_a1, (userptr_t)tf->tf_a2);
+}
+
+#if OPT_A3
+static
+int
+sc_spawn(struct trapframe *tf, int32_t *retval)
+{
+	return sys_spawn((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (pid_t *)retval);
+}
+#endif
+
+static
+int
+sc_asyncsetup(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_asyncsetup((userptr_t)tf->tf_a0);
+}
+
+static
+int
+sc_asyncsubmit(struct trapframe *tf, int32_t *retval)
+{
+	(void)tf;
+	return sys_asyncsubmit((int *)retval);
+}
+
+static
+int
+sc_setaffinity(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_setaffinity((pid_t)tf->tf_a0, (unsigned)tf->tf_a1);
+}
+
+static
+int
+sc_getaffinity(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_getaffinity((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+#endif /* OPT_A2 */
+
+static
+int
+sc_syscallstats(struct trapframe *tf, int32_t *retval)
+{
+	return sys_syscallstats((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				(int *)retval);
+}
+
+/*
+ * The system call table, indexed by call number. Empty slots are
+ * calls we don't implement.
+ */
+static const struct {
+	const char *name;
+	int (*func)(struct trapframe *tf, int32_t *retval);
+} syscalls[SCSTAT_NCALLS] = {
+	[SYS_reboot]		= { "reboot",		sc_reboot },
+	[SYS___time]		= { "__time",		sc___time },
+#ifdef UW
+	[SYS_write]		= { "write",		sc_write },
+	[SYS__exit]		= { "_exit",		sc__exit },
+	[SYS_getpid]		= { "getpid",		sc_getpid },
+	[SYS_waitpid]		= { "waitpid",		sc_waitpid },
+#endif
+#if OPT_A2
+	[SYS_fork]		= { "fork",		sc_fork },
+	[SYS_execv]		= { "execv",		sc_execv },
+	[SYS_open]		= { "open",		sc_open },
+	[SYS_read]		= { "read",		sc_read },
+	[SYS_lseek]		= { "lseek",		sc_lseek },
+	[SYS_close]		= { "close",		sc_close },
+	[SYS_dup2]		= { "dup2",		sc_dup2 },
+	[SYS_ioctl]		= { "ioctl",		sc_ioctl },
+#if OPT_A3
+	[SYS_spawn]		= { "spawn",		sc_spawn },
+#endif
+	[SYS_asyncsetup]	= { "asyncsetup",	sc_asyncsetup },
+	[SYS_asyncsubmit]	= { "asyncsubmit",	sc_asyncsubmit },
+	[SYS_setaffinity]	= { "setaffinity",	sc_setaffinity },
+	[SYS_getaffinity]	= { "getaffinity",	sc_getaffinity },
+#endif
+	[SYS_syscallstats]	= { "syscallstats",	sc_syscallstats },
+};
+
+/*
+ * Latency histogram bucket for a call that took SECS/NSECS.
+ */
+static
+unsigned
+syscall_bucket(time_t secs, uint32_t nsecs)
+{
+	uint32_t usecs;
+	unsigned b;
+
+	if (secs >= 1) {
+		return SCSTAT_NBUCKETS - 1;
+	}
+	usecs = nsecs / 1000;
+	for (b = 0; usecs >= 2 && b < SCSTAT_NBUCKETS - 1; b++) {
+		usecs >>= 1;
+	}
+	return b;
+}
 
 /*
  * System call dispatcher.
@@ -75,6 +328,10 @@
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
+ *
+ * Each call is counted, and timed with the real-time clock, in the
+ * statistics of the cpu it was made on. The thread may sleep and
+ * return on another cpu, so the cpu is looked up again afterwards.
  */
 void
 syscall(struct trapframe *tf)
@@ -83,6 +340,10 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
+	struct syscallstat *st;
+	int spl;
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -101,55 +362,30 @@ syscall(struct trapframe *tf)
 
 	retval = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1);
-		break;
-#ifdef UW
-	case SYS_write:
-	  err = sys_write((int)tf->tf_a0,
-			  (userptr_t)tf->tf_a1,
-			  (int)tf->tf_a2,
-			  (int *)(&retval));
-	  break;
-	case SYS__exit:
-	  sys__exit((int)tf->tf_a0);
-	  /* sys__exit does not return, execution should not get here */
-	  panic("unexpected return from sys__exit");
-	  break;
-	case SYS_getpid:
-	  err = sys_getpid((pid_t *)&retval);
-	  break;
-	case SYS_waitpid:
-	  err = sys_waitpid((pid_t)tf->tf_a0,
-			    (userptr_t)tf->tf_a1,
-			    (int)tf->tf_a2,
-			    (pid_t *)&retval);
-	  break;
-#endif // UW
-
-	    /* Add stuff here */
-#if OPT_A2
-	case SYS_fork:
-	  DEBUG(DB_SYSCALL, "sys_fork:\n");
-	  err = sys_fork(tf,(pid_t *)&retval);
-	  break;
-	case SYS_execv:
-	  DEBUG(DB_SYSEXECV, "syscall called sys_execv\n");
-	  err = sys_execv((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
-	  break;
-#endif
-	default:
-	  kprintf("Unknown syscall %d\n", callno);
-	  err = ENOSYS;
-	  break;
+	if (callno < 0 || callno >= SCSTAT_NCALLS ||
+	    syscalls[callno].func == NULL) {
+		DEBUG(DB_SYSCALL, "Unknown syscall %d\n", callno);
+		err = ENOSYS;
 	}
+	else {
+		/* curcpu can't change under us with interrupts off */
+		spl = splhigh();
+		curcpu->c_syscallstats[callno].ss_count++;
+		splx(spl);
+
+		gettime(&secs1, &nsecs1);
+		err = syscalls[callno].func(tf, &retval);
+		gettime(&secs2, &nsecs2);
+		getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
 
+		spl = splhigh();
+		st = &curcpu->c_syscallstats[callno];
+		if (err) {
+			st->ss_errors++;
+		}
+		st->ss_hist[syscall_bucket(secs2, nsecs2)]++;
+		splx(spl);
+	}
 
 	if (err) {
 		/*
@@ -202,3 +438,79 @@ enter_forked_process(struct trapframe *tf)
 		(void)tf;
 	#endif
 }
+
+/*
+ * syscallstats: copy out the statistics of call numbers 0 through
+ * NSTATS-1, summed over all cpus. Returns how many were copied.
+ */
+int
+sys_syscallstats(userptr_t buf, size_t nstats, int *retval)
+{
+	struct syscallstat *sum;
+	int result;
+
+	if (nstats > SCSTAT_NCALLS) {
+		nstats = SCSTAT_NCALLS;
+	}
+
+	sum = kmalloc(SCSTAT_NCALLS * sizeof(struct syscallstat));
+	if (sum == NULL) {
+		return ENOMEM;
+	}
+	cpu_syscallstats(sum);
+	result = copyout(sum, buf, nstats * sizeof(struct syscallstat));
+	kfree(sum);
+	if (result) {
+		return result;
+	}
+	*retval = nstats;
+	return 0;
+}
+
+/*
+ * Print the statistics of every call that has been made, for the
+ * kernel menu.
+ */
+void
+syscall_printstats(void)
+{
+	struct syscallstat *sum;
+	unsigned i, b;
+
+	sum = kmalloc(SCSTAT_NCALLS * sizeof(struct syscallstat));
+	if (sum == NULL) {
+		kprintf("syscall_printstats: out of memory\n");
+		return;
+	}
+	cpu_syscallstats(sum);
+
+	kprintf("%-14s %8s %8s  latency (usecs: calls)\n",
+		"call", "count", "errors");
+	for (i=0; i<SCSTAT_NCALLS; i++) {
+		if (sum[i].ss_count == 0) {
+			continue;
+		}
+		if (syscalls[i].name != NULL) {
+			kprintf("%-14s", syscalls[i].name);
+		}
+		else {
+			kprintf("#%-13u", i);
+		}
+		kprintf(" %8u %8u ", sum[i].ss_count, sum[i].ss_errors);
+		for (b=0; b<SCSTAT_NBUCKETS; b++) {
+			if (sum[i].ss_hist[b] == 0) {
+				continue;
+			}
+			if (b == 0) {
+				kprintf(" <2: %u", sum[i].ss_hist[b]);
+			}
+			else {
+				kprintf(" %u%s: %u", 1U << b,
+					b == SCSTAT_NBUCKETS - 1 ? "+" : "",
+					sum[i].ss_hist[b]);
+			}
+		}
+		kprintf("\n");
+	}
+	kfree(sum);
+}
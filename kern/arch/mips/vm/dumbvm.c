@@ -29,14 +29,21 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/timepage.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
 #include <proc.h>
+#include <cpu.h>
 #include <current.h>
+#include <clock.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <uw-vmstats.h>
 
 #include "opt-A3.h"
 /*
@@ -47,6 +54,8 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+#undef DUMBVM_CHECKED	/* walk the page tables on every fault */
+
 /*
  * Wrap rma_stealmem in a spinlock.
  */
@@ -56,8 +65,6 @@ static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
  * Globals
  */
 #if OPT_A3
-	struct coremap *coremap_table;
-	int frame_num = 0;
 	bool vm_booted = false;
 #endif
 
@@ -66,37 +73,11 @@ vm_bootstrap(void)
 {
 #if OPT_A3
 	DEBUG(DB_MEMORY, "************virtual memory booting************\n");
-	/*get remaining physical memory and partition to each frame*/
-
-	// lo is first physical addr. hi is last
-	paddr_t lo, hi, paddr_i;
-	ram_getsize(&lo, &hi);
-
-	//page size is 4kb(4096byte)
-	frame_num = (hi - lo) / PAGE_SIZE;
-	paddr_t actual_lo = lo + frame_num * (sizeof(struct coremap));
-	actual_lo = ROUNDUP(actual_lo, PAGE_SIZE);
-	DEBUG(DB_MEMORY, "frame_num is %d\n", frame_num);
-	DEBUG(DB_MEMORY, "first physical address is %d\n", lo);
-	DEBUG(DB_MEMORY, "actual first physical address is %d\n", actual_lo);
-	DEBUG(DB_MEMORY, "last physical address is %d\n", hi);
-	DEBUG(DB_MEMORY, "--------------------------------\n");
-
-	/*keep track of status of each frame*/
-	paddr_i = actual_lo;
-	frame_num = (hi - actual_lo) / PAGE_SIZE;
-	DEBUG(DB_MEMORY, "new frame_num is %d\n", frame_num);
-	coremap_table = (struct coremap*)PADDR_TO_KVADDR(lo);
-
-	for (int i=0; i<frame_num; i++) {
-		//DEBUG(DB_MEMORY, "paddr_i is %d\n", (int)paddr_i);
-		coremap_table[i].paddr = paddr_i;
-		coremap_table[i].available = true;
-		coremap_table[i].contiguous = false;
-		coremap_table[i].contiguous_frame_num = 0;
-		paddr_i += PAGE_SIZE;
-	}
+	/* hand the rest of physical memory to the buddy allocator */
+	coremap_bootstrap();
+	vmstats_init();
 	vm_booted = true;
+	swap_bootstrap();
 #endif
 }
 
@@ -106,71 +87,459 @@ getppages(unsigned long npages)
 {
 	paddr_t addr;
 #if OPT_A3
-	if (!vm_booted) {
-		spinlock_acquire(&stealmem_lock);
-
-		addr = ram_stealmem(npages);
-
-		spinlock_release(&stealmem_lock);
-		return addr;
-	} else {
-		//should not call ram_stealmen again
-		//DEBUG(DB_MEMORY, "----------getting page after booted----------\n");
-		//DEBUG(DB_MEMORY, "Need to find %d contiguous frames\n", (int) npages);
-
-		spinlock_acquire(&stealmem_lock);
-
-		int i=0;
-		unsigned long first_frame = 0;
-		bool contiguous_block = true;
-
-		while(i < frame_num) {
-
-			if (coremap_table[i].available) {
-				first_frame = i;
-				for (unsigned long j=1; j<npages; j++) {
-					if (!(coremap_table[i+j].available)) {
-						DEBUG(DB_MEMORY, "coremap_table[%d] is unavailable\n", (int)(i+j));
-						contiguous_block = false;
-						break;
-					}
-				}
-				if (contiguous_block) {
-					//DEBUG(DB_MEMORY, "contiguous block found, first frame is %d\n", (int)first_frame);
-					for (unsigned long l=first_frame; l<npages+first_frame; l++) {
-						if (l == first_frame) {
-							addr = coremap_table[i].paddr;
-							coremap_table[l].contiguous_frame_num = npages;
-						}
-						coremap_table[l].available = false;
-						coremap_table[l].contiguous = true;
-					}
-					//DEBUG(DB_MEMORY, "Calling break;\n");
-					break;
-				}
-			}
-
-			i++;
-			//DEBUG(DB_MEMORY, "Still in while loop;\n");
-		}
-		if (!contiguous_block){
-			DEBUG(DB_MEMORY, "contiguous_block not found\n");
-			addr = 0;
-		}
-		spinlock_release(&stealmem_lock);
-		//DEBUG(DB_MEMORY, "addr to return is %d\n", (int)addr);
-		return addr;
+	if (vm_booted) {
+		return coremap_alloc(npages);
 	}
-#else
+#endif
 	spinlock_acquire(&stealmem_lock);
 
 	addr = ram_stealmem(npages);
 
 	spinlock_release(&stealmem_lock);
 	return addr;
+}
+
+#if OPT_A3
+static
+void
+freeppages(paddr_t paddr)
+{
+	KASSERT(vm_booted);
+	coremap_free(paddr);
+}
+
+/*
+ * Get a frame for a user page, paging something out if memory is
+ * full. Kernel allocations never wait for the disk.
+ */
+static
+paddr_t
+getuserpage(void)
+{
+	paddr_t paddr;
+
+	paddr = getppages(1);
+	if (paddr == 0) {
+		paddr = swap_evict();
+	}
+	return paddr;
+}
 #endif
+
+static
+void
+as_zero_region(paddr_t paddr, unsigned npages)
+{
+	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
 }
 
+#if OPT_A3
+/*
+ * Address space IDs. User TLB entries are tagged with the ASID of
+ * their address space, so switching processes needs no flush. ASIDs
+ * are handed out in order; when all NUM_TLBPID are gone a new
+ * generation starts, every address space has to get a fresh one, and
+ * each CPU flushes its TLB the next time it activates anything.
+ */
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_generation = 1;
+static unsigned asid_next;
+#endif
+
+/*
+ * Throw away every translation in this CPU's TLB.
+ */
+static
+void
+vm_tlb_flush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+#if OPT_A3
+	curcpu->c_tlb_next = 0;
+	tlb_setpid(curcpu->c_asid << TLBHI_PIDSHIFT);
+#endif
+
+	splx(spl);
+#if OPT_A3
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+#endif
+}
+
+#if OPT_A3
+/*
+ * Stop using AS's current ASID, so that every TLB entry tagged with it,
+ * on any CPU, becomes unreachable at once. ASIDs are not reused until
+ * the next generation, by which time each CPU will have flushed. This
+ * is much cheaper than a shootdown when a whole address space changes.
+ * If AS is current it gets a fresh ASID here; otherwise (spawn loads
+ * into an address space that isn't running yet) on its next activation.
+ */
+static
+void
+as_retire_asid(struct addrspace *as)
+{
+	spinlock_acquire(&asid_lock);
+	as->as_asid_gen = 0;
+	spinlock_release(&asid_lock);
+	if (as == curproc_getas()) {
+		as_activate();
+	}
+}
+#endif
+
+#if OPT_A3
+/*
+ * Fill in the region descriptor vm_fault uses for region IDX.
+ */
+static
+void
+as_set_region(struct addrspace *as, int idx, vaddr_t vbase, size_t npages,
+	      paddr_t *pt, bool writeable)
+{
+	KASSERT(idx >= 0 && idx < AS_NREGIONS);
+
+	as->as_regions[idx].ar_vbase = vbase;
+	as->as_regions[idx].ar_vtop = vbase + npages * PAGE_SIZE;
+	as->as_regions[idx].ar_pt = pt;
+	as->as_regions[idx].ar_writeable = writeable;
+}
+
+/*
+ * Find the page table entry that maps VADDR, or NULL if VADDR is not in
+ * any region. *WRITEABLE says whether user writes to the page are
+ * allowed at all; the text segment stays writable until load_elf is done.
+ */
+static
+paddr_t *
+as_lookup_pte(struct addrspace *as, vaddr_t vaddr, bool *writeable)
+{
+	const struct as_region *r;
+
+	for (r = as->as_regions; r < as->as_regions + AS_NREGIONS; r++) {
+		if (vaddr >= r->ar_vbase && vaddr < r->ar_vtop) {
+			*writeable = r->ar_writeable;
+			return &r->ar_pt[(vaddr - r->ar_vbase) / PAGE_SIZE];
+		}
+	}
+	return NULL;
+}
+
+#ifdef DUMBVM_CHECKED
+/*
+ * Consistency check of a whole address space. Far too slow to do on
+ * every fault unless you are chasing page table corruption.
+ */
+static
+void
+as_check(struct addrspace *as)
+{
+	size_t i;
+
+	KASSERT(as->page_table1 != NULL);
+	KASSERT(as->page_table2 != NULL);
+	KASSERT(as->stack_page_table != NULL);
+
+	for (i=0; i<as->as_npages1; i++) {
+		KASSERT((as->page_table1[i] & PAGE_FRAME) == (as->page_table1[i] & ~(PTE_COW|PTE_SWAPPED)));
+	}
+	for (i=0; i<as->as_npages2; i++) {
+		KASSERT((as->page_table2[i] & PAGE_FRAME) == (as->page_table2[i] & ~(PTE_COW|PTE_SWAPPED)));
+	}
+	for (i=0; i<DUMBVM_STACKPAGES; i++) {
+		KASSERT((as->stack_page_table[i] & PAGE_FRAME) == (as->stack_page_table[i] & ~(PTE_COW|PTE_SWAPPED)));
+	}
+
+	/* Assert that the address space has been set up properly. */
+	KASSERT(as->as_vbase1 != 0);
+	KASSERT(as->as_npages1 != 0);
+	KASSERT(as->as_vbase2 != 0);
+	KASSERT(as->as_npages2 != 0);
+	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
+	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
+
+	KASSERT(as->as_regions[0].ar_pt == as->page_table1);
+	KASSERT(as->as_regions[1].ar_pt == as->page_table2);
+	KASSERT(as->as_regions[AS_STACK_REGION].ar_pt == as->stack_page_table);
+}
+#endif
+
+/*
+ * First write to a copy-on-write page that is still shared: give this
+ * address space its own copy. (If every other address space has let go
+ * of the frame, vm_fault just takes it over instead.) Getting the new
+ * frame may page things out, so the entry is checked again before it
+ * is replaced.
+ */
+static
+int
+as_cow_break(struct addrspace *as, vaddr_t vaddr, paddr_t *pte)
+{
+	paddr_t entry, oldpa, newpa;
+	struct tlbshootdown ts;
+	uint32_t cpus;
+
+	spinlock_acquire(&as->as_lock);
+	entry = *pte;
+	spinlock_release(&as->as_lock);
+
+	newpa = getuserpage();
+	if (newpa == 0) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	if (*pte != entry) {
+		spinlock_release(&as->as_lock);
+		freeppages(newpa);
+		return 0;
+	}
+	oldpa = entry & PAGE_FRAME;
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	*pte = newpa;
+	coremap_set_owner(newpa, as, vaddr);
+	ts.ts_asid = as->as_asid;
+	ts.ts_vaddr = vaddr;
+	spinlock_acquire(&asid_lock);
+	cpus = as->as_cpus;
+	spinlock_release(&asid_lock);
+	spinlock_release(&as->as_lock);
+
+	/*
+	 * A CPU we ran on before may still map the old frame read-only.
+	 * Once the last other sharer takes the frame over and writes to
+	 * it, that entry would show us their data, so it has to go
+	 * before the old frame is let go of.
+	 */
+	vm_tlbshootdown_batch(cpus, &ts, 1);
+
+	coremap_decref(oldpa);
+	return 0;
+}
+
+/*
+ * Share every page of a segment between two page tables. Resident
+ * pages are marked copy-on-write in both; swapped-out pages share the
+ * swap slot, and whichever side faults first reads in its own copy.
+ */
+static
+void
+as_share_pages(paddr_t *old, paddr_t *new, size_t npages)
+{
+	for (size_t i=0; i<npages; i++) {
+		if (old[i] & PTE_SWAPPED) {
+			swap_incref(PTE_SLOT(old[i]));
+		}
+		else if (old[i] != 0) {
+			old[i] |= PTE_COW;
+			coremap_incref(old[i] & PAGE_FRAME);
+		}
+		new[i] = old[i];
+	}
+}
+
+/*
+ * Drop this address space's references to the frames and swap slots
+ * of a segment.
+ */
+static
+void
+as_release_pages(paddr_t *pt, size_t npages)
+{
+	if (pt == NULL) {
+		return;
+	}
+	for (size_t i=0; i<npages; i++) {
+		if (pt[i] & PTE_SWAPPED) {
+			swap_decref(PTE_SLOT(pt[i]));
+		}
+		else if (pt[i] != 0) {
+			coremap_decref(pt[i] & PAGE_FRAME);
+		}
+	}
+}
+
+/*
+ * Where page faults in AS are counted: the current process, except
+ * while spawn fills in the stack of a new process (as_proc) from its
+ * parent.
+ */
+static
+struct rusage *
+as_rusage(struct addrspace *as)
+{
+	if (as->as_proc != NULL) {
+		return &as->as_proc->p_rusage;
+	}
+	return &curproc->p_rusage;
+}
+
+/*
+ * First touch of a page: get a zeroed frame and read in whatever part
+ * of the page is backed by the executable. The frame is handed back
+ * in *RET for vm_fault to map.
+ */
+static
+int
+as_page_in(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	vaddr_t file_vaddr, start, end;
+	off_t file_offset;
+	size_t file_size;
+	paddr_t paddr;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	if (vaddr >= as->as_vbase1 &&
+	    vaddr < as->as_vbase1 + as->as_npages1 * PAGE_SIZE) {
+		file_vaddr = as->as_file_vaddr1;
+		file_offset = as->as_file_offset1;
+		file_size = as->as_file_size1;
+	}
+	else if (vaddr >= as->as_vbase2 &&
+		 vaddr < as->as_vbase2 + as->as_npages2 * PAGE_SIZE) {
+		file_vaddr = as->as_file_vaddr2;
+		file_offset = as->as_file_offset2;
+		file_size = as->as_file_size2;
+	}
+	else {
+		/* the stack is always zero-filled */
+		file_vaddr = 0;
+		file_offset = 0;
+		file_size = 0;
+	}
+
+	paddr = getuserpage();
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	as_zero_region(paddr, 1);
+
+	/* the part of [vaddr, vaddr+PAGE_SIZE) that lies in the file image */
+	start = vaddr > file_vaddr ? vaddr : file_vaddr;
+	end = vaddr + PAGE_SIZE;
+	if (end > file_vaddr + file_size) {
+		end = file_vaddr + file_size;
+	}
+
+	if (file_size == 0 || start >= end) {
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		as_rusage(as)->ru_minflt++;
+		*ret = paddr;
+		return 0;
+	}
+
+	KASSERT(as->as_vnode != NULL);
+	uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(paddr) + (start - vaddr)),
+		  end - start, file_offset + (start - file_vaddr), UIO_READ);
+	result = VOP_READ(as->as_vnode, &ku);
+	if (result == 0 && ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		result = ENOEXEC;
+	}
+	if (result) {
+		freeppages(paddr);
+		return result;
+	}
+
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_inc(VMSTAT_ELF_FILE_READ);
+	as_rusage(as)->ru_majflt++;
+	*ret = paddr;
+	return 0;
+}
+
+/*
+ * Bring a paged-out page back from its swap slot. Holding swap_lock
+ * makes sure the slot has finished being written.
+ */
+static
+int
+as_swap_in(struct addrspace *as, vaddr_t vaddr, paddr_t *pte)
+{
+	paddr_t entry, paddr;
+	int result;
+
+	swap_lock_acquire();
+
+	spinlock_acquire(&as->as_lock);
+	entry = *pte;
+	spinlock_release(&as->as_lock);
+	if (!(entry & PTE_SWAPPED)) {
+		swap_lock_release();
+		return 0;
+	}
+
+	paddr = getuserpage();
+	if (paddr == 0) {
+		swap_lock_release();
+		return ENOMEM;
+	}
+	result = swap_read(PTE_SLOT(entry), paddr);
+	if (result) {
+		swap_lock_release();
+		freeppages(paddr);
+		return result;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	KASSERT(*pte == entry);
+	*pte = paddr;
+	coremap_set_owner(paddr, as, vaddr);
+	spinlock_release(&as->as_lock);
+
+	swap_decref(PTE_SLOT(entry));
+	swap_lock_release();
+
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	as_rusage(as)->ru_majflt++;
+	return 0;
+}
+
+/*
+ * Called by the evictor in swap.c, which holds swap_lock. Fills in TS
+ * and adds to *CPUS what needs to be shot down.
+ */
+int
+as_page_out(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+	    unsigned slot, struct tlbshootdown *ts, uint32_t *cpus)
+{
+	paddr_t *pte;
+	bool writeable;
+
+	spinlock_acquire(&as->as_lock);
+	pte = as_lookup_pte(as, vaddr, &writeable);
+	if (pte == NULL || (*pte & PTE_SWAPPED) ||
+	    (*pte & PAGE_FRAME) != paddr || coremap_refcount(paddr) != 1) {
+		spinlock_release(&as->as_lock);
+		return EBUSY;
+	}
+	*pte = PTE_MKSWAP(slot);
+
+	/*
+	 * The caller shoots down the old translation before the page is
+	 * written out. Entries tagged with an ASID from an older
+	 * generation can no longer be used anywhere.
+	 */
+	ts->ts_asid = as->as_asid;
+	ts->ts_vaddr = vaddr;
+	spinlock_acquire(&asid_lock);
+	*cpus |= as->as_cpus;
+	spinlock_release(&asid_lock);
+	spinlock_release(&as->as_lock);
+	return 0;
+}
+#endif
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t
 alloc_kpages(int npages)
@@ -187,26 +556,7 @@ void
 free_kpages(vaddr_t addr)
 {
 #if OPT_A3
-	DEBUG(DB_MEMORY, "********freeing kpages********\n");
-	spinlock_acquire(&stealmem_lock);
-	int i=0;
-	//DEBUG(DB_MEMORY, "frame_num is %d\n", frame_num);
-	DEBUG(DB_MEMORY, "addr is %d\n", (int) addr);
-	while(i < frame_num) {
-		//DEBUG(DB_MEMORY, "coremap_table[i].paddr is %d\n", (int) coremap_table[i].paddr);
-		if (coremap_table[i].paddr == addr) {
-			int contiguous_num = coremap_table[i].contiguous_frame_num;
-			for (int j=0; j<contiguous_num; j++) {
-				coremap_table[i+j].available = true;
-				coremap_table[i+j].contiguous = false;
-				coremap_table[i+j].contiguous_frame_num = 0;
-				DEBUG(DB_MEMORY, "frame %d is freed\n", i+j);
-			}
-			break;
-		}
-		i++;
-	}
-	spinlock_release(&stealmem_lock);
+	freeppages(KVADDR_TO_PADDR(addr));
 #else
 	/* nothing - leak the memory. */
 
@@ -217,26 +567,123 @@ free_kpages(vaddr_t addr)
 void
 vm_tlbshootdown_all(void)
 {
+#if OPT_A3
+	vm_tlb_flush();
+#else
 	panic("dumbvm tried to do tlb shootdown?!\n");
+#endif
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
+#if OPT_A3
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(ts->ts_vaddr | (ts->ts_asid << TLBHI_PIDSHIFT), 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setpid(curcpu->c_asid << TLBHI_PIDSHIFT);
+	splx(spl);
+#else
 	(void)ts;
 	panic("dumbvm tried to do tlb shootdown?!\n");
+#endif
 }
 
+#if OPT_A3
+/*
+ * Invalidate a batch of mappings on this CPU and on the CPUs in CPUS,
+ * sending each of them one IPI for the lot, and wait until they are
+ * gone everywhere.
+ */
+void
+vm_tlbshootdown_batch(uint32_t cpus, const struct tlbshootdown *ts,
+		      unsigned n)
+{
+	unsigned i;
+	int spl;
+
+	/*
+	 * Do our own TLB and drop ourselves from the mask on the same
+	 * CPU. If we moved in between, the CPU we move to could be left
+	 * out; once we're off the mask, moving is harmless, as every CPU
+	 * still in it gets the IPI, even the one we end up on.
+	 */
+	spl = splhigh();
+	for (i=0; i<n; i++) {
+		vm_tlbshootdown(&ts[i]);
+	}
+	cpus &= ~((uint32_t)1 << curcpu->c_number);
+	splx(spl);
+	if (cpus != 0) {
+		ipi_tlbshootdown_sync(cpus, ts, n);
+	}
+}
+#endif
+
+#if OPT_A3
+/*
+ * Pick the TLB slot to fill next, round-robin. Each CPU has its own
+ * TLB and so its own position; call with interrupts off so we stay on
+ * this CPU.
+ */
+static
+int
+vm_tlb_victim(void)
+{
+	int i;
+
+	KASSERT(curthread->t_iplhigh_count > 0);
+	i = curcpu->c_tlb_next;
+	curcpu->c_tlb_next = (i + 1) % NUM_TLB;
+	return i;
+}
+
+/*
+ * Map the time page, read-only, for a process that touched it.
+ */
+static
+int
+vm_fault_timepage(struct addrspace *as, int faulttype)
+{
+	uint32_t ehi, elo;
+	int i, spl;
+
+	if (faulttype != VM_FAULT_READ) {
+		return EFAULT;
+	}
+	ehi = TIMEPAGE_VADDR | (as->as_asid << TLBHI_PIDSHIFT);
+	elo = timepage_paddr() | TLBLO_VALID;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	i = vm_tlb_victim();
+	tlb_write(ehi, elo, i);
+	splx(spl);
+	return 0;
+}
+#endif
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	//DEBUG(DB_MEMORY, "!---------------vm_fault---------------!\n");
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
 	int i;
 	uint32_t ehi, elo;
 	struct addrspace *as;
+#if OPT_A3
+	paddr_t *pte, entry;
+	bool writeable, resident;
+	uint32_t oldhi, oldlo;
+	int result;
+#else
 	int spl;
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+#endif
 
 	faultaddress &= PAGE_FRAME;
 
@@ -245,10 +692,14 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
 #if OPT_A3
-	    /* don't panic, kill the process */
-	    return 1;
+		/* write to a read-only mapping; copy-on-write is checked below */
+		break;
 #else
-		/* We always create pages read-write, so we can't get this */
+		/* a store to the time page, which is mapped read-only */
+		if (faultaddress == TIMEPAGE_VADDR) {
+			return EFAULT;
+		}
+		/* We create every other page read-write, so we can't get this */
 		panic("dumbvm: got VM_FAULT_READONLY\n");
 #endif
 	    case VM_FAULT_READ:
@@ -277,35 +728,135 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	}
 #if OPT_A3
 
-	KASSERT(as->page_table1 != NULL);
-	KASSERT(as->page_table2 != NULL);
-	KASSERT(as->stack_page_table != NULL);
+#ifdef DUMBVM_CHECKED
+	as_check(as);
+#endif
+
+	if (faultaddress == TIMEPAGE_VADDR) {
+		return vm_fault_timepage(as, faulttype);
+	}
+
+	pte = as_lookup_pte(as, faultaddress, &writeable);
+	if (pte == NULL) {
+		return EFAULT;
+	}
+	if (faulttype == VM_FAULT_READONLY && !writeable) {
+		/* don't panic, kill the process */
+		return EFAULT;
+	}
+	if (faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_FAULT);
+	}
 
-	for (size_t i=0; i<as->as_npages1; i++) {
-		KASSERT((as->page_table1[i] & PAGE_FRAME) == as->page_table1[i]);
+	/*
+	 * The entry can only be trusted while as_lock is held, since the
+	 * evictor may swap the page out at any time. Anything that needs
+	 * a new frame or the disk is done with the lock dropped, and then
+	 * we look again.
+	 */
+	resident = true;
+	for (;;) {
+		spinlock_acquire(&as->as_lock);
+		entry = *pte;
+		if (entry == 0 || (entry & PTE_SWAPPED)) {
+			resident = false;
+		}
+		else if (!(entry & PTE_COW) ||
+			 faulttype != VM_FAULT_READONLY) {
+			break;
+		}
+		else if (coremap_refcount(entry & PAGE_FRAME) == 1) {
+			/* every other sharer has let go; take it over */
+			entry &= PAGE_FRAME;
+			*pte = entry;
+			break;
+		}
+		spinlock_release(&as->as_lock);
+
+		if (entry == 0) {
+			/* not touched yet: demand-load or zero-fill it */
+			result = as_page_in(as, faultaddress, &paddr);
+			if (result) {
+				return result;
+			}
+			spinlock_acquire(&as->as_lock);
+			if (*pte == 0) {
+				*pte = paddr;
+				coremap_set_owner(paddr, as, faultaddress);
+				paddr = 0;
+			}
+			spinlock_release(&as->as_lock);
+			if (paddr != 0) {
+				freeppages(paddr);
+			}
+		}
+		else if (entry & PTE_SWAPPED) {
+			result = as_swap_in(as, faultaddress, pte);
+			if (result) {
+				return result;
+			}
+		}
+		else if (!(entry & PTE_COW)) {
+			/* VM_FAULT_READONLY on a page we own outright */
+			return EFAULT;
+		}
+		else {
+			result = as_cow_break(as, faultaddress, pte);
+			if (result) {
+				return result;
+			}
+			as_rusage(as)->ru_minflt++;
+		}
 	}
-	for (size_t i=0; i<as->as_npages2; i++) {
-		KASSERT((as->page_table2[i] & PAGE_FRAME) == as->page_table2[i]);
+
+	if (resident && faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_RELOAD);
 	}
-	for (size_t i=0; i<DUMBVM_STACKPAGES; i++) {
-		KASSERT((as->stack_page_table[i] & PAGE_FRAME) == as->stack_page_table[i]);
+
+	paddr = entry & PAGE_FRAME;
+	KASSERT(paddr != 0);
+	coremap_touch(paddr, as, faultaddress);
+
+	/*
+	 * Shared pages are mapped read-only so the first write traps
+	 * back here as VM_FAULT_READONLY.
+	 */
+	ehi = faultaddress | (as->as_asid << TLBHI_PIDSHIFT);
+	elo = paddr | TLBLO_VALID;
+	if (writeable && !(entry & PTE_COW)) {
+		elo |= TLBLO_DIRTY;
 	}
 
-	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_vbase1 != 0);
-	KASSERT(as->as_pbase1 != 0);
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	KASSERT(as->as_pbase2 != 0);
-	KASSERT(as->as_npages2 != 0);
-	KASSERT(as->as_stackpbase != 0);
-	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
-	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-#endif
+	/* as_lock has interrupts off on this CPU while we frob the TLB */
 
+	if (faulttype == VM_FAULT_READONLY) {
+		/* upgrade the read-only entry that trapped */
+		i = tlb_probe(ehi, 0);
+		if (i >= 0) {
+			tlb_write(ehi, elo, i);
+			spinlock_release(&as->as_lock);
+			return 0;
+		}
+	}
+
+	/*
+	 * A miss means there is no entry for this page, so no probe is
+	 * needed; take the next slot round-robin. After a flush that fills
+	 * the free slots in order before anything gets replaced.
+	 */
+	i = vm_tlb_victim();
+	tlb_read(&oldhi, &oldlo, i);
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	tlb_write(ehi, elo, i);
+	spinlock_release(&as->as_lock);
+	if (oldlo & TLBLO_VALID) {
+		vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	}
+	else {
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+	}
+	return 0;
+#else
 	vbase1 = as->as_vbase1;
 	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
 	vbase2 = as->as_vbase2;
@@ -322,6 +873,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
 	}
+	else if (faultaddress == TIMEPAGE_VADDR &&
+		 faulttype == VM_FAULT_READ) {
+		paddr = timepage_paddr();
+	}
 	else {
 		return EFAULT;
 	}
@@ -338,36 +893,20 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 			continue;
 		}
 		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-#if OPT_A3
-		/*if segment is in text and load_elf is completed,
-		 *set TLBLO_DIRT to false
-		 */
-		bool load_complete = as->load_elf_complete;
-		if (faultaddress >= vbase1 && faultaddress < vtop1 && load_complete) {
-			elo&=~TLBLO_DIRTY;
+		elo = paddr | TLBLO_VALID;
+		if (faultaddress != TIMEPAGE_VADDR) {
+			elo |= TLBLO_DIRTY;
 		}
-#endif
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
 		splx(spl);
 		return 0;
 	}
-#if OPT_A3
-	//handle TLB Fault
-	ehi = faultaddress;
-	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-	bool load_complete = as->load_elf_complete;
-	if (faultaddress >= vbase1 && faultaddress < vtop1 && load_complete) {
-		elo&=~TLBLO_DIRTY;
-	}
-	tlb_random(ehi,elo);
-	splx(spl);
-	return 0;
-#endif
+
 	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
 	splx(spl);
 	return EFAULT;
+#endif
 }
 
 struct addrspace *
@@ -379,6 +918,7 @@ as_create(void)
 	}
 #if OPT_A3
 	as->load_elf_complete = false;
+	as->as_vnode = NULL;
 
 	as->as_vbase1 = 0;
 	as->page_table1 = NULL;
@@ -386,6 +926,9 @@ as_create(void)
 	as->page_table1_readable = true;
 	as->page_table1_writeable = true;
 	as->page_table1_executable = true;
+	as->as_file_vaddr1 = 0;
+	as->as_file_offset1 = 0;
+	as->as_file_size1 = 0;
 
 	as->as_vbase2 = 0;
 	as->page_table2 = NULL;
@@ -393,8 +936,21 @@ as_create(void)
 	as->page_table2_readable = false;
 	as->page_table2_writeable = false;
 	as->page_table2_executable = false;
+	as->as_file_vaddr2 = 0;
+	as->as_file_offset2 = 0;
+	as->as_file_size2 = 0;
 
 	as->stack_page_table = NULL;
+	spinlock_init(&as->as_lock);
+
+	for (int i=0; i<AS_NREGIONS; i++) {
+		as_set_region(as, i, 0, 0, NULL, false);
+	}
+
+	as->as_asid = 0;
+	as->as_asid_gen = 0;	/* no ASID until first activated */
+	as->as_cpus = 0;
+	as->as_proc = NULL;
 #else
 	as->as_vbase1 = 0;
 	as->as_pbase1 = 0;
@@ -413,21 +969,23 @@ as_destroy(struct addrspace *as)
 {
 #if OPT_A3
 	DEBUG(DB_MEMORY, "!---------------as_destroy---------------!\n");
-	for (size_t i=0; i<as->as_npages1; i++) {
-		//DEBUG(DB_MEMORY, "as->page_table1[%d] is %d\n", i, (int)as->page_table1[i]);
-		free_kpages(as->page_table1[i]);
-	}
-	for (size_t i=0; i<as->as_npages2; i++) {
-		//DEBUG(DB_MEMORY, "as->page_table2[%d] is %d\n", i, (int)as->page_table2[i]);
-		free_kpages(as->page_table2[i]);
-	}
-	for (size_t i=0; i<DUMBVM_STACKPAGES; i++) {
-		//DEBUG(DB_MEMORY, "as->stack_page_table[%d] is %d\n", i, (int)as->stack_page_table[i]);
-		free_kpages(as->stack_page_table[i]);
-	}
+	/*
+	 * Frames shared copy-on-write are only freed by their last user.
+	 * swap_lock keeps the evictor from paging out one of ours while
+	 * we tear the page tables down.
+	 */
+	swap_lock_acquire();
+	as_release_pages(as->page_table1, as->as_npages1);
+	as_release_pages(as->page_table2, as->as_npages2);
+	as_release_pages(as->stack_page_table, DUMBVM_STACKPAGES);
+	swap_lock_release();
+	spinlock_cleanup(&as->as_lock);
 	kfree(as->page_table1);
 	kfree(as->page_table2);
 	kfree(as->stack_page_table);
+	if (as->as_vnode != NULL) {
+		vfs_close(as->as_vnode);
+	}
 	kfree(as);
 #else
 	kfree(as);
@@ -437,8 +995,11 @@ as_destroy(struct addrspace *as)
 void
 as_activate(void)
 {
-	int i, spl;
 	struct addrspace *as;
+#if OPT_A3
+	uint32_t gen;
+	int spl;
+#endif
 
 	as = curproc_getas();
 #ifdef UW
@@ -448,14 +1009,35 @@ as_activate(void)
 		return;
 	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
+#if OPT_A3
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	spinlock_acquire(&asid_lock);
+	if (as->as_asid_gen != asid_generation) {
+		if (asid_next == NUM_TLBPID) {
+			asid_generation++;
+			asid_next = 0;
+		}
+		as->as_asid = asid_next++;
+		as->as_asid_gen = asid_generation;
+		as->as_cpus = 0;
 	}
+	gen = asid_generation;
+	as->as_cpus |= (uint32_t)1 << curcpu->c_number;
+	spinlock_release(&asid_lock);
+
+	curcpu->c_asid = as->as_asid;
+	if (curcpu->c_asid_gen != gen) {
+		/* our TLB may hold entries for ASIDs that were handed out again */
+		vm_tlb_flush();
+		curcpu->c_asid_gen = gen;
+	}
+	tlb_setpid(as->as_asid << TLBHI_PIDSHIFT);
 
 	splx(spl);
+#else
+	vm_tlb_flush();
+#endif
 }
 
 void
@@ -464,6 +1046,26 @@ as_deactivate(void)
 	/* nothing */
 }
 
+#if OPT_A3
+/*
+ * Allocate a page table with every entry empty, so a partially built
+ * address space can always be torn down by as_destroy.
+ */
+static
+paddr_t *
+as_create_page_table(size_t npages)
+{
+	paddr_t *pt;
+
+	pt = kmalloc(npages * sizeof(paddr_t));
+	if (pt == NULL) {
+		return NULL;
+	}
+	bzero(pt, npages * sizeof(paddr_t));
+	return pt;
+}
+#endif
+
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
@@ -485,26 +1087,41 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	DEBUG(DB_MEMORY, "npages %d\n", npages);
 #if OPT_A3
 	if (as->stack_page_table == NULL) {
-		as->stack_page_table = kmalloc(DUMBVM_STACKPAGES * sizeof(paddr_t));
+		as->stack_page_table = as_create_page_table(DUMBVM_STACKPAGES);
+		if (as->stack_page_table == NULL) {
+			return ENOMEM;
+		}
+		as_set_region(as, AS_STACK_REGION,
+			      USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE,
+			      DUMBVM_STACKPAGES, as->stack_page_table, true);
 		DEBUG(DB_MEMORY, "stack_page_table created!\n");
 	}
 	if (as->page_table1 == NULL) {
+		as->page_table1 = as_create_page_table(npages);
+		if (as->page_table1 == NULL) {
+			return ENOMEM;
+		}
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
-		as->page_table1 = kmalloc(npages * sizeof(paddr_t));
 		as->page_table1_readable = readable;
 		as->page_table1_writeable = writeable;
 		as->page_table1_executable = executable;
+		/* writable until as_complete_load so load_elf can fill it */
+		as_set_region(as, 0, vaddr, npages, as->page_table1, true);
 		DEBUG(DB_MEMORY, "page_table1 created! %d pages\n", npages);
 		return 0;
 	}
 	if (as->page_table2 == NULL) {
+		as->page_table2 = as_create_page_table(npages);
+		if (as->page_table2 == NULL) {
+			return ENOMEM;
+		}
 		as->as_vbase2 = vaddr;
 		as->as_npages2 = npages;
-		as->page_table2 = kmalloc(npages * sizeof(paddr_t));
 		as->page_table2_readable = readable;
 		as->page_table2_writeable = writeable;
 		as->page_table2_executable = executable;
+		as_set_region(as, 1, vaddr, npages, as->page_table2, true);
 		DEBUG(DB_MEMORY, "page_table2 created! %d pages\n", npages);
 		return 0;
 	}
@@ -534,13 +1151,6 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	return EUNIMP;
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
-{
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
-}
-
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -548,43 +1158,12 @@ as_prepare_load(struct addrspace *as)
 	DEBUG(DB_MEMORY, "!---------------as_prepare_load---------------!\n");
 	KASSERT(as->page_table1 != NULL);
 	KASSERT(as->page_table2 != NULL);
-	//KASSERT(as->stack_page_table != NULL);
+	KASSERT(as->stack_page_table != NULL);
 
-	for (size_t i=0; i<as->as_npages1; i++) {
-		as->page_table1[i] = getppages(1);
-		//DEBUG(DB_MEMORY, "as->page_table1[%d] is %d\n", i, (int)as->page_table1[i]);
-		if (i==0) {
-			as->as_pbase1 = as->page_table1[i];
-		}
-		if (as->page_table1[i] == 0) {
-			return ENOMEM;
-		}
-		as_zero_region(as->page_table1[i], 1);
-	}
-	DEBUG(DB_MEMORY, "page_table1 loaded\n");
-	for (size_t i=0; i<as->as_npages2; i++) {
-		as->page_table2[i] = getppages(1);
-		//DEBUG(DB_MEMORY, "as->page_table2[%d] is %d\n", i, (int)as->page_table2[i]);
-		if (i==0) {
-			as->as_pbase2 = as->page_table2[i];
-		}
-		if (as->page_table2[i] == 0) {
-			return ENOMEM;
-		}
-		as_zero_region(as->page_table2[i], 1);
-	}
-	DEBUG(DB_MEMORY, "page_table2 loaded\n");
-	for (int i=0; i<DUMBVM_STACKPAGES; i++) {
-		as->stack_page_table[i] = getppages(1);
-		//DEBUG(DB_MEMORY, "as->stack_page_table[%d] is %d\n", i, (int)as->stack_page_table[i]);
-		if (i==0) {
-			as->as_stackpbase = as->stack_page_table[i];
-		}
-		if (as->stack_page_table[i] == 0) {
-			return ENOMEM;
-		}
-		as_zero_region(as->stack_page_table[i], 1);
-	}
+	/*
+	 * Nothing to allocate: every page, stack included, is read in or
+	 * zero-filled by vm_fault the first time it is touched.
+	 */
 #else
 	KASSERT(as->as_pbase1 == 0);
 	KASSERT(as->as_pbase2 == 0);
@@ -613,6 +1192,45 @@ as_prepare_load(struct addrspace *as)
 	return 0;
 }
 
+#if OPT_A3
+/*
+ * Record that FILESIZE bytes of the segment at VADDR come from offset
+ * OFFSET of V. The address space keeps V open until it is destroyed.
+ */
+int
+as_define_file(struct addrspace *as, struct vnode *v, off_t offset,
+	       vaddr_t vaddr, size_t filesize)
+{
+	if (as->as_vnode == NULL) {
+		VOP_INCOPEN(v);
+		VOP_INCREF(v);
+		as->as_vnode = v;
+	}
+	KASSERT(as->as_vnode == v);
+
+	/* nothing reads through uiomove any more, so check for kernel space */
+	if (vaddr + filesize < vaddr || vaddr + filesize > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	if (vaddr >= as->as_vbase1 &&
+	    vaddr + filesize <= as->as_vbase1 + as->as_npages1 * PAGE_SIZE) {
+		as->as_file_vaddr1 = vaddr;
+		as->as_file_offset1 = offset;
+		as->as_file_size1 = filesize;
+		return 0;
+	}
+	if (vaddr >= as->as_vbase2 &&
+	    vaddr + filesize <= as->as_vbase2 + as->as_npages2 * PAGE_SIZE) {
+		as->as_file_vaddr2 = vaddr;
+		as->as_file_offset2 = offset;
+		as->as_file_size2 = filesize;
+		return 0;
+	}
+	return EFAULT;
+}
+#endif
+
 int
 as_complete_load(struct addrspace *as)
 {
@@ -622,7 +1240,10 @@ as_complete_load(struct addrspace *as)
 	*flush the TLB
 	*/
 	as->load_elf_complete = true;
-	as_activate();
+	as->as_regions[0].ar_writeable = as->page_table1_writeable;
+	as->as_regions[1].ar_writeable = as->page_table2_writeable;
+	/* drop the writable entries load_elf left for the text segment */
+	as_retire_asid(as);
 	return 0;
 #else
 	(void)as;
@@ -635,7 +1256,11 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
 
 	DEBUG(DB_MEMORY, "!---------------as_define_stack---------------!\n");
+#if OPT_A3
+	KASSERT(as->stack_page_table != NULL);
+#else
 	KASSERT(as->as_stackpbase != 0);
+#endif
 
 	*stackptr = USERSTACK;
 	return 0;
@@ -652,34 +1277,74 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
-	new->as_vbase1 = old->as_vbase1;
-	new->as_npages1 = old->as_npages1;
-	new->as_vbase2 = old->as_vbase2;
-	new->as_npages2 = old->as_npages2;
-
 #if OPT_A3
+	new->load_elf_complete = old->load_elf_complete;
+
 	new->page_table1_readable   = old->page_table1_readable;
 	new->page_table1_writeable  = old->page_table1_writeable;
 	new->page_table1_executable = old->page_table1_executable;
 	new->page_table2_readable   = old->page_table2_readable;
 	new->page_table2_writeable  = old->page_table2_writeable;
 	new->page_table2_executable = old->page_table2_executable;
-#endif
 
-#if OPT_A3
-	if (new->stack_page_table == NULL) {
-		new->stack_page_table = kmalloc(DUMBVM_STACKPAGES * sizeof(paddr_t));
-		DEBUG(DB_MEMORY, "stack_page_table copy created!\n");
-	}
-	if (new->page_table1 == NULL) {
-		new->page_table1 = kmalloc(new->as_npages1 * sizeof(paddr_t));
-		DEBUG(DB_MEMORY, "page_table1 copy created! %d pages\n", new->as_npages1);
+	new->page_table1 = as_create_page_table(old->as_npages1);
+	new->page_table2 = as_create_page_table(old->as_npages2);
+	new->stack_page_table = as_create_page_table(DUMBVM_STACKPAGES);
+	if (new->page_table1 == NULL || new->page_table2 == NULL ||
+	    new->stack_page_table == NULL) {
+		as_destroy(new);
+		return ENOMEM;
 	}
-	if (new->page_table2 == NULL) {
-		new->page_table2 = kmalloc(new->as_npages2 * sizeof(paddr_t));
-		DEBUG(DB_MEMORY, "page_table2 copy created! %d pages\n", new->as_npages1);
+
+	new->as_vbase1 = old->as_vbase1;
+	new->as_npages1 = old->as_npages1;
+	new->as_vbase2 = old->as_vbase2;
+	new->as_npages2 = old->as_npages2;
+
+	new->as_file_vaddr1 = old->as_file_vaddr1;
+	new->as_file_offset1 = old->as_file_offset1;
+	new->as_file_size1 = old->as_file_size1;
+	new->as_file_vaddr2 = old->as_file_vaddr2;
+	new->as_file_offset2 = old->as_file_offset2;
+	new->as_file_size2 = old->as_file_size2;
+
+	as_set_region(new, 0, new->as_vbase1, new->as_npages1,
+		      new->page_table1, old->as_regions[0].ar_writeable);
+	as_set_region(new, 1, new->as_vbase2, new->as_npages2,
+		      new->page_table2, old->as_regions[1].ar_writeable);
+	as_set_region(new, AS_STACK_REGION,
+		      USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE,
+		      DUMBVM_STACKPAGES, new->stack_page_table, true);
+
+	if (old->as_vnode != NULL) {
+		/* pages neither side has touched yet still come from here */
+		VOP_INCOPEN(old->as_vnode);
+		VOP_INCREF(old->as_vnode);
+		new->as_vnode = old->as_vnode;
 	}
-#endif
+
+	/*
+	 * Copy-on-write: both address spaces map the same frames
+	 * read-only, and whichever writes first gets its own copy in
+	 * vm_fault. Only the page tables are copied here.
+	 */
+	spinlock_acquire(&old->as_lock);
+	as_share_pages(old->page_table1, new->page_table1, old->as_npages1);
+	as_share_pages(old->page_table2, new->page_table2, old->as_npages2);
+	as_share_pages(old->stack_page_table, new->stack_page_table,
+		       DUMBVM_STACKPAGES);
+	spinlock_release(&old->as_lock);
+
+	/*
+	 * old is the caller's address space. Its writable TLB entries,
+	 * here or on any CPU it ran on before, must go.
+	 */
+	as_retire_asid(old);
+#else
+	new->as_vbase1 = old->as_vbase1;
+	new->as_npages1 = old->as_npages1;
+	new->as_vbase2 = old->as_vbase2;
+	new->as_npages2 = old->as_npages2;
 
 	/* (Mis)use as_prepare_load to allocate some physical memory. */
 	if (as_prepare_load(new)) {
@@ -687,34 +1352,10 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
-#if OPT_A3
-	KASSERT(new->page_table1 != NULL);
-	KASSERT(new->page_table2 != NULL);
-	KASSERT(new->stack_page_table != NULL);
-#endif
-
 	KASSERT(new->as_pbase1 != 0);
 	KASSERT(new->as_pbase2 != 0);
 	KASSERT(new->as_stackpbase != 0);
-#if OPT_A3
-	for (size_t i=0; i<new->as_npages1; i++) {
-		memmove((void *)PADDR_TO_KVADDR(new->page_table1[i]),
-				(const void *)PADDR_TO_KVADDR(old->page_table1[i]),
-					old->as_npages1*PAGE_SIZE);
-	}
-
-	for (size_t i=0; i<new->as_npages2; i++) {
-		memmove((void *)PADDR_TO_KVADDR(new->page_table2[i]),
-				(const void *)PADDR_TO_KVADDR(old->page_table2[i]),
-					old->as_npages2*PAGE_SIZE);
-	}
 
-	for (size_t i=0; i<DUMBVM_STACKPAGES; i++) {
-		memmove((void *)PADDR_TO_KVADDR(new->stack_page_table[i]),
-				(const void *)PADDR_TO_KVADDR(old->stack_page_table[i]),
-					DUMBVM_STACKPAGES*PAGE_SIZE);
-	}
-#else
 	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
 		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
 		old->as_npages1*PAGE_SIZE);
@@ -726,7 +1367,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
- #endif
+#endif
 
 	*ret = new;
 	return 0;
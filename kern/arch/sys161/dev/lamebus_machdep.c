@@ -55,7 +55,9 @@
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted. Writing to c0_compare again clears the interrupt. On
+ * System/161 it also zeroes c0_count, so the value written is the
+ * number of cycles until the next interrupt.
  */
 static
 void
@@ -73,6 +75,46 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/*
+ * Clock tick timer. Keep the count well clear of wrapping around.
+ */
+#define TIMER_MAXCYCLES 0x7fffffff
+
+void
+mainbus_timer_set(unsigned nticks)
+{
+	KASSERT(nticks > 0 && nticks <= mainbus_timer_maxticks());
+	mips_timer_set(nticks * (CPU_FREQUENCY / hz));
+}
+
+unsigned
+mainbus_timer_maxticks(void)
+{
+	return TIMER_MAXCYCLES / (CPU_FREQUENCY / hz);
+}
+
+unsigned
+mainbus_timer_elapsed(void)
+{
+	return mips_timer_get() / (CPU_FREQUENCY / hz);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -111,9 +153,9 @@ mainbus_bootstrap(void)
 	autoconf_lamebus(lamebus, 0);
 
 	/*
-	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
+	 * Configure the MIPS on-chip timer to interrupt hz times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(CPU_FREQUENCY / hz);
 }
 
 /*
@@ -269,7 +311,7 @@ mainbus_interrupt(struct trapframe *tf)
 	}
 	else if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		mips_timer_set(CPU_FREQUENCY / hz);
 		/* and call hardclock */
 		hardclock();
 	}
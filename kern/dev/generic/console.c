@@ -39,6 +39,10 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Otherwise output is queued in a ring buffer that the device's
+ * write-done interrupt drains, so writers don't wait for each
+ * character to go out.
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -46,17 +50,21 @@
  * and (2) if the system crashes before we find a console, no output
  * at all may appear.
  *
- * Note that we have no input buffering; characters typed too rapidly
- * will be lost.
+ * Input for user reads goes through a small line discipline (see
+ * con_ldisc) unless the console has been put in raw mode. Characters
+ * typed faster than they can be taken are still lost, though.
  */
 
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <kern/ioctl.h>
 #include <uio.h>
+#include <copyinout.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -142,6 +150,95 @@ putch_complete_polled(struct con_softc *cs)
 
 //////////////////////////////////////////////////
 
+/*
+ * Output through the transmit ring.
+ *
+ * Characters are queued in cs_txbuf and the device is handed the next
+ * one each time it reports the previous one done (con_start), so a
+ * writer only has to sleep when the ring is full. It is then woken
+ * once the ring is down to half full, not once per character.
+ *
+ * All of these are called with cs_txlock held.
+ */
+
+static
+unsigned
+con_txcount(struct con_softc *cs)
+{
+	return (cs->cs_txbuf_head + CONSOLE_OUTPUT_BUFFER_SIZE -
+		cs->cs_txbuf_tail) % CONSOLE_OUTPUT_BUFFER_SIZE;
+}
+
+/*
+ * If the device is idle, give it the next character.
+ */
+static
+void
+con_txkick(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	if (cs->cs_txbusy || cs->cs_txbuf_head == cs->cs_txbuf_tail) {
+		return;
+	}
+	ch = cs->cs_txbuf[cs->cs_txbuf_tail];
+	cs->cs_txbuf_tail = (cs->cs_txbuf_tail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	cs->cs_txbusy = true;
+	cs->cs_send(cs->cs_devdata, ch);
+}
+
+/*
+ * Sleep on cs_txwchan, dropping cs_txlock meanwhile. As in P(), the
+ * wchan is locked before cs_txlock is released so a wakeup from
+ * con_start can't slip in between.
+ */
+static
+void
+con_txsleep(struct con_softc *cs)
+{
+	wchan_lock(cs->cs_txwchan);
+	spinlock_release(&cs->cs_txlock);
+	wchan_sleep(cs->cs_txwchan);
+	spinlock_acquire(&cs->cs_txlock);
+}
+
+/*
+ * Queue one character, waiting for room if necessary. (The ring keeps
+ * one slot empty so that head == tail means empty.)
+ */
+static
+void
+con_txput(struct con_softc *cs, int ch)
+{
+	while (con_txcount(cs) == CONSOLE_OUTPUT_BUFFER_SIZE - 1) {
+		con_txkick(cs);
+		cs->cs_txwaitroom = true;
+		con_txsleep(cs);
+	}
+	cs->cs_txbuf[cs->cs_txbuf_head] = ch;
+	cs->cs_txbuf_head = (cs->cs_txbuf_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+}
+
+/*
+ * Queue LEN bytes of user output, turning newlines into CR-LF.
+ */
+static
+void
+con_write(struct con_softc *cs, const char *buf, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_txlock);
+	for (i=0; i<len; i++) {
+		if (buf[i] == '\n') {
+			con_txput(cs, '\r');
+		}
+		con_txput(cs, buf[i]);
+	}
+	con_txkick(cs);
+	spinlock_release(&cs->cs_txlock);
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -149,8 +246,28 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	spinlock_acquire(&cs->cs_txlock);
+	con_txput(cs, ch);
+	con_txkick(cs);
+	spinlock_release(&cs->cs_txlock);
+}
+
+/*
+ * Wait until everything queued has gone out. kprintf does this at the
+ * end of each message, so kernel messages are on the screen by the
+ * time it returns, as they were when output was unbuffered.
+ */
+static
+void
+putch_complete_intr(struct con_softc *cs)
+{
+	spinlock_acquire(&cs->cs_txlock);
+	con_txkick(cs);
+	while (cs->cs_txbusy) {
+		cs->cs_txwaitdrain = true;
+		con_txsleep(cs);
+	}
+	spinlock_release(&cs->cs_txlock);
 }
 
 /*
@@ -162,13 +279,173 @@ getch_intr(struct con_softc *cs)
 {
 	unsigned char ret;
 
+	/* while we wait, con_input must leave typed characters raw */
+	spinlock_acquire(&cs->cs_rxlock);
+	cs->cs_rawwaiters++;
+	spinlock_release(&cs->cs_rxlock);
+
 	P(cs->cs_rsem);
 	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+
+	spinlock_acquire(&cs->cs_rxlock);
+	cs->cs_rawwaiters--;
+	spinlock_release(&cs->cs_rxlock);
 	return ret;
 }
 
+//////////////////////////////////////////////////
+
+/*
+ * Line discipline.
+ *
+ * In canonical mode typed characters are echoed and collected in
+ * cs_line, where backspace (or DEL) erases the last one and ^U the
+ * whole line. Return or newline finishes the line, as does filling
+ * the buffer, and only then are readers woken, so a read() of a line
+ * costs one wakeup rather than one per keystroke. ^D finishes the
+ * line without adding anything; if the line was empty the read
+ * returns 0, which programs take as end of file.
+ */
+
+/*
+ * Echo typed input. Called from the interrupt handler, so if the
+ * output ring is full the echo is dropped rather than waited for.
+ */
+static
+void
+con_echo(struct con_softc *cs, const char *str)
+{
+	spinlock_acquire(&cs->cs_txlock);
+	for (; *str; str++) {
+		if (con_txcount(cs) == CONSOLE_OUTPUT_BUFFER_SIZE - 1) {
+			break;
+		}
+		cs->cs_txbuf[cs->cs_txbuf_head] = *str;
+		cs->cs_txbuf_head =
+			(cs->cs_txbuf_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	}
+	con_txkick(cs);
+	spinlock_release(&cs->cs_txlock);
+}
+
+/*
+ * Hand everything typed so far to readers.
+ */
+static
+void
+con_ldisc_finish(struct con_softc *cs)
+{
+	cs->cs_line_ready = cs->cs_line_head;
+	wchan_wakeall(cs->cs_rxwchan);
+}
+
+/*
+ * Take one typed character. Called with cs_rxlock held.
+ */
+static
+void
+con_ldisc(struct con_softc *cs, int ch)
+{
+	unsigned nexthead;
+	char echo[2];
+
+	switch (ch) {
+	    case '\b':
+	    case 127:
+		if (cs->cs_line_head != cs->cs_line_ready) {
+			cs->cs_line_head = (cs->cs_line_head +
+			      CONSOLE_LINE_BUFFER_SIZE - 1) %
+				CONSOLE_LINE_BUFFER_SIZE;
+			con_echo(cs, "\b \b");
+		}
+		return;
+	    case 21: /* ^U */
+		while (cs->cs_line_head != cs->cs_line_ready) {
+			cs->cs_line_head = (cs->cs_line_head +
+			      CONSOLE_LINE_BUFFER_SIZE - 1) %
+				CONSOLE_LINE_BUFFER_SIZE;
+			con_echo(cs, "\b \b");
+		}
+		return;
+	    case 4: /* ^D */
+		if (cs->cs_line_head == cs->cs_line_ready) {
+			cs->cs_line_eof = true;
+		}
+		con_ldisc_finish(cs);
+		return;
+	    case '\r':
+		ch = '\n';
+		break;
+	}
+
+	nexthead = (cs->cs_line_head + 1) % CONSOLE_LINE_BUFFER_SIZE;
+	if (nexthead == cs->cs_line_tail) {
+		/* nobody is reading what we already have; drop it */
+		con_echo(cs, "\a");
+		return;
+	}
+	cs->cs_line[cs->cs_line_head] = ch;
+	cs->cs_line_head = nexthead;
+
+	if (ch == '\n') {
+		con_echo(cs, "\r\n");
+		con_ldisc_finish(cs);
+		return;
+	}
+
+	echo[0] = ch;
+	echo[1] = 0;
+	con_echo(cs, echo);
+
+	nexthead = (cs->cs_line_head + 1) % CONSOLE_LINE_BUFFER_SIZE;
+	if (nexthead == cs->cs_line_tail) {
+		/* full */
+		con_ldisc_finish(cs);
+	}
+}
+
+/*
+ * Read in canonical mode: wait for a finished line and return as much
+ * of it as fits, at most one line per call.
+ */
+static
+int
+con_readline(struct con_softc *cs, struct uio *uio)
+{
+	char buf[CONSOLE_LINE_BUFFER_SIZE];
+	size_t len;
+	char ch;
+
+	spinlock_acquire(&cs->cs_rxlock);
+	while (cs->cs_line_tail == cs->cs_line_ready && !cs->cs_line_eof) {
+		wchan_lock(cs->cs_rxwchan);
+		spinlock_release(&cs->cs_rxlock);
+		wchan_sleep(cs->cs_rxwchan);
+		spinlock_acquire(&cs->cs_rxlock);
+	}
+
+	len = 0;
+	if (cs->cs_line_tail == cs->cs_line_ready) {
+		/* ^D on an empty line */
+		cs->cs_line_eof = false;
+	}
+	while (cs->cs_line_tail != cs->cs_line_ready &&
+	       len < uio->uio_resid) {
+		ch = cs->cs_line[cs->cs_line_tail];
+		cs->cs_line_tail =
+			(cs->cs_line_tail + 1) % CONSOLE_LINE_BUFFER_SIZE;
+		buf[len++] = ch;
+		if (ch == '\n') {
+			break;
+		}
+	}
+	spinlock_release(&cs->cs_rxlock);
+
+	return uiomove(buf, len, uio);
+}
+
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
@@ -184,6 +461,14 @@ con_input(void *vcs, int ch)
 	struct con_softc *cs = vcs;
 	unsigned nexthead;
 
+	spinlock_acquire(&cs->cs_rxlock);
+	if (!cs->cs_raw && cs->cs_rawwaiters == 0) {
+		con_ldisc(cs, ch);
+		spinlock_release(&cs->cs_rxlock);
+		return;
+	}
+	spinlock_release(&cs->cs_rxlock);
+
 	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	if (nexthead == cs->cs_gotchars_tail) {
 		/* overflow; drop character */
@@ -203,8 +488,24 @@ void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
-
-	V(cs->cs_wsem);
+	bool wake = false;
+
+	spinlock_acquire(&cs->cs_txlock);
+	cs->cs_txbusy = false;
+	con_txkick(cs);
+	if (cs->cs_txwaitroom &&
+	    con_txcount(cs) <= CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		cs->cs_txwaitroom = false;
+		wake = true;
+	}
+	if (cs->cs_txwaitdrain && !cs->cs_txbusy) {
+		cs->cs_txwaitdrain = false;
+		wake = true;
+	}
+	if (wake) {
+		wchan_wakeall(cs->cs_txwchan);
+	}
+	spinlock_release(&cs->cs_txlock);
 }
 
 //////////////////////////////////////////////////
@@ -261,7 +562,7 @@ putch_complete(void)
 		putch_complete_polled(cs);
 	}
 	else {
-		/* nothing */
+		putch_complete_intr(cs);
 	}
 }
 
@@ -298,16 +599,23 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/*
+ * Bytes of user output moved into the ring per uiomove.
+ */
+#define CON_WRITECHUNK 128
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
 	int result;
 	char ch;
+	char buf[CON_WRITECHUNK];
+	size_t len;
+	bool raw;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -318,6 +626,17 @@ con_io(struct device *dev, struct uio *uio)
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
+	if (uio->uio_rw==UIO_READ) {
+		spinlock_acquire(&cs->cs_rxlock);
+		raw = cs->cs_raw;
+		spinlock_release(&cs->cs_rxlock);
+		if (!raw) {
+			result = con_readline(cs, uio);
+			lock_release(lk);
+			return result;
+		}
+	}
+
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
 			ch = getch();
@@ -334,15 +653,21 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			/*
+			 * Holding con_userlock_write across the whole uio
+			 * keeps one write's output together; we return as
+			 * soon as the last of it is in the ring.
+			 */
+			len = uio->uio_resid;
+			if (len > sizeof(buf)) {
+				len = sizeof(buf);
+			}
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+			con_write(cs, buf, len);
 		}
 	}
 	lock_release(lk);
@@ -353,10 +678,25 @@ static
 int
 con_ioctl(struct device *dev, int op, userptr_t data)
 {
-	/* No ioctls. */
-	(void)dev;
-	(void)op;
-	(void)data;
+	struct con_softc *cs = dev->d_data;
+	int raw, result;
+
+	switch (op) {
+	    case TIOCGRAW:
+		spinlock_acquire(&cs->cs_rxlock);
+		raw = cs->cs_raw;
+		spinlock_release(&cs->cs_rxlock);
+		return copyout(&raw, data, sizeof(raw));
+	    case TIOCSRAW:
+		result = copyin(data, &raw, sizeof(raw));
+		if (result) {
+			return result;
+		}
+		spinlock_acquire(&cs->cs_rxlock);
+		cs->cs_raw = raw != 0;
+		spinlock_release(&cs->cs_rxlock);
+		return 0;
+	}
 	return EINVAL;
 }
 
@@ -398,7 +738,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *txwc, *rxwc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -418,29 +759,51 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	txwc = wchan_create("console write");
+	if (txwc == NULL) {
+		sem_destroy(rsem);
+		return ENOMEM;
+	}
+	rxwc = wchan_create("console read");
+	if (rxwc == NULL) {
 		sem_destroy(rsem);
+		wchan_destroy(txwc);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(txwc);
+		wchan_destroy(rxwc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(txwc);
+		wchan_destroy(rxwc);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	spinlock_init(&cs->cs_txlock);
+	cs->cs_txwchan = txwc;
+	cs->cs_txbuf_head = 0;
+	cs->cs_txbuf_tail = 0;
+	cs->cs_txbusy = false;
+	cs->cs_txwaitroom = false;
+	cs->cs_txwaitdrain = false;
+	spinlock_init(&cs->cs_rxlock);
+	cs->cs_rxwchan = rxwc;
+	cs->cs_line_head = 0;
+	cs->cs_line_ready = 0;
+	cs->cs_line_tail = 0;
+	cs->cs_line_eof = false;
+	cs->cs_raw = false;
+	cs->cs_rawwaiters = 0;
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -37,7 +37,13 @@
  * device, and are to be initialized by the attach routine.
  */
 
+#include <spinlock.h>
+
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
+#define CONSOLE_LINE_BUFFER_SIZE 256
+
+struct wchan;
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -49,10 +55,40 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	/*
+	 * Output ring. Writers fill it and the write-done interrupt
+	 * (con_start) feeds it to the device a character at a time.
+	 */
+	struct spinlock cs_txlock;	/* protects the fields below */
+	struct wchan *cs_txwchan;	/* writers waiting for room/drain */
+	unsigned char cs_txbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_txbuf_head;		/* next slot to put a char in */
+	unsigned cs_txbuf_tail;		/* next slot to take a char out */
+	bool cs_txbusy;			/* device is sending a char */
+	bool cs_txwaitroom;		/* someone waits for room in the ring */
+	bool cs_txwaitdrain;		/* someone waits for all output to finish */
+
+	/*
+	 * Line discipline. Unless the console is in raw mode, con_input
+	 * edits typed characters into cs_line and wakes readers only when
+	 * a line is finished (or the buffer fills up). Readers take
+	 * characters from the tail up to cs_line_ready; from there to the
+	 * head is the line still being typed. Kernel callers of getch()
+	 * always get raw characters, through cs_gotchars.
+	 */
+	struct spinlock cs_rxlock;	/* protects the fields below */
+	struct wchan *cs_rxwchan;	/* readers waiting for a line */
+	unsigned char cs_line[CONSOLE_LINE_BUFFER_SIZE];
+	unsigned cs_line_head;		/* next slot to put a char in */
+	unsigned cs_line_ready;		/* end of the finished lines */
+	unsigned cs_line_tail;		/* next slot to take a char out */
+	bool cs_line_eof;		/* ^D typed: next read returns 0 */
+	bool cs_raw;			/* raw mode (TIOCSRAW) */
+	unsigned cs_rawwaiters;		/* threads in getch() */
 };
 
 /*
@@ -36,6 +36,7 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-A3.h"
 
 struct vnode;
@@ -48,12 +49,44 @@ struct vnode;
  * You write this.
  */
 
+#if OPT_A3
+/*
+ * Page table entries hold the physical address of the frame, or 0 if
+ * there is none. The low bits are free because frames are page-aligned.
+ * A page that has been paged out keeps its swap slot number in place
+ * of the frame address instead.
+ */
+#define PTE_COW     0x00000001  /* frame is shared; copy on first write */
+#define PTE_SWAPPED 0x00000002  /* upper bits are a swap slot */
+#define PTE_SLOT(pte)      ((pte) >> 12)
+#define PTE_MKSWAP(slot)   (((paddr_t)(slot) << 12) | PTE_SWAPPED)
+
+/*
+ * What vm_fault needs to know about each region, kept together so a
+ * fault is a couple of range checks and an index into a page table.
+ * Regions 0 and 1 are the two ELF segments, region 2 is the stack.
+ * An unused region has ar_vbase == ar_vtop.
+ */
+#define AS_NREGIONS     3
+#define AS_STACK_REGION 2
+
+struct as_region {
+  vaddr_t ar_vbase;
+  vaddr_t ar_vtop;
+  paddr_t *ar_pt;
+  bool ar_writeable;           /* user writes allowed right now */
+};
+#endif
+
 struct addrspace {
 
 #if OPT_A3
 
   bool load_elf_complete;
 
+  /* executable the segments are demand-loaded from */
+  struct vnode *as_vnode;
+
   /*code segment*/
   vaddr_t as_vbase1;
   paddr_t *page_table1;
@@ -61,6 +94,9 @@ struct addrspace {
   bool page_table1_readable;
   bool page_table1_writeable;
   bool page_table1_executable;
+  vaddr_t as_file_vaddr1;   /* first byte backed by the file */
+  off_t as_file_offset1;
+  size_t as_file_size1;
 
   /*data segment*/
   vaddr_t as_vbase2;
@@ -69,12 +105,22 @@ struct addrspace {
   bool page_table2_readable;
   bool page_table2_writeable;
   bool page_table2_executable;
+  vaddr_t as_file_vaddr2;
+  off_t as_file_offset2;
+  size_t as_file_size2;
 
   paddr_t *stack_page_table;
+  struct spinlock as_lock;     /* page table entries vs. page-out */
 
-  paddr_t as_pbase1;
-  paddr_t as_pbase2;
-  paddr_t as_stackpbase;
+  struct as_region as_regions[AS_NREGIONS];
+
+  /* TLB tag; only meaningful while as_asid_gen is the current one */
+  unsigned as_asid;
+  uint32_t as_asid_gen;
+  uint32_t as_cpus;            /* CPUs that may hold entries for as_asid */
+
+  /* process page faults are counted against, if not curproc (spawn) */
+  struct proc *as_proc;
 #else
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -114,6 +160,16 @@ struct addrspace {
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
+ *    as_define_file - record which part of the executable backs a
+ *                segment, so that vm_fault can read pages in on
+ *                first touch instead of load_elf reading them all.
+ *
+ *    as_page_out - unmap the page at VADDR, currently in frame PADDR,
+ *                and remember that it now lives in swap slot SLOT.
+ *                Fails if the page has since been shared or moved.
+ *                Fills in the TLB shootdown the caller must do
+ *                before the frame's contents are written out.
+ *
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
@@ -134,18 +190,28 @@ int               as_define_region(struct addrspace *as,
                                    int writeable,
                                    int executable);
 int               as_prepare_load(struct addrspace *as);
+#if OPT_A3
+int               as_define_file(struct addrspace *as, struct vnode *v,
+                                 off_t offset, vaddr_t vaddr,
+                                 size_t filesize);
+int               as_page_out(struct addrspace *as, vaddr_t vaddr,
+                              paddr_t paddr, unsigned slot,
+                              struct tlbshootdown *ts, uint32_t *cpus);
+#endif
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
 
 /*
  * Functions in loadelf.c
- *    load_elf - load an ELF user program executable into the current
- *               address space. Returns the entry point (initial PC)
- *               in the space pointed to by ENTRYPOINT.
+ *    load_elf - load an ELF user program executable into address space
+ *               AS. Returns the entry point (initial PC) in the space
+ *               pointed to by ENTRYPOINT. Unless segments are loaded
+ *               on demand (OPT_A3), AS must be the current address
+ *               space.
  */
 
-int load_elf(struct vnode *v, vaddr_t *entrypoint);
+int load_elf(struct addrspace *as, struct vnode *v, vaddr_t *entrypoint);
 
 
 #endif /* _ADDRSPACE_H_ */
@@ -0,0 +1,42 @@
+#ifndef _ARGBUF_H_
+#define _ARGBUF_H_
+
+/*
+ * Program arguments on their way into a new address space (execv,
+ * spawn, and runprogram from the menu).
+ *
+ * The strings are kept back to back, each NUL-terminated, in a single
+ * buffer that grows as needed. Together with the argv array the
+ * program will see, they may take up at most ARG_MAX bytes. The cost
+ * of an exec is thus proportional to the bytes actually passed, not
+ * to the number of arguments times the longest one allowed.
+ */
+struct argbuf {
+	char *ab_buf;		/* the strings */
+	size_t ab_len;		/* bytes of ab_buf in use */
+	size_t ab_max;		/* bytes of ab_buf allocated */
+	int ab_nargs;		/* number of strings */
+};
+
+/*
+ * Functions:
+ *    argbuf_init       - initialize to empty.
+ *    argbuf_cleanup    - free the buffer, leaving it empty again.
+ *    argbuf_fromuser   - append the NULL-terminated argv array at UARGV
+ *                        in the current address space.
+ *    argbuf_fromkernel - append the NULL-terminated array ARGS.
+ *    argbuf_copyout    - put the strings and an argv array pointing at
+ *                        them on the user stack below *STACKPTR, one
+ *                        copyout each. Leaves *STACKPTR pointing at
+ *                        argv, suitably aligned.
+ *
+ * The append functions fail with E2BIG if the ARG_MAX limit is hit;
+ * the argbuf must then still be cleaned up by the caller.
+ */
+void argbuf_init(struct argbuf *ab);
+void argbuf_cleanup(struct argbuf *ab);
+int argbuf_fromuser(struct argbuf *ab, userptr_t uargv);
+int argbuf_fromkernel(struct argbuf *ab, char **args);
+int argbuf_copyout(const struct argbuf *ab, vaddr_t *stackptr);
+
+#endif /* _ARGBUF_H_ */
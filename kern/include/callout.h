@@ -0,0 +1,60 @@
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called a given number of clock ticks
+ * (hardclocks; see clock.h) from now.
+ *
+ * Each CPU has its own timer wheel, and a callout goes on the wheel of
+ * the CPU that schedules it. That CPU's hardclock runs it once its
+ * time is up, in interrupt context: the function must not sleep.
+ *
+ * The caller owns the struct callout and must keep it around until it
+ * has run or been stopped. Calls on any one callout must not race
+ * with each other (though they may race with it running).
+ *
+ * callout_init     - set up C to call FN(ARG).
+ * callout_schedule - (re)arrange for C to run TICKS ticks from now
+ *                    (at least 1). If it was already pending, the old
+ *                    time is forgotten.
+ * callout_stop     - cancel C. Returns true if it was pending; false
+ *                    if it had already run (or is running right now).
+ *
+ * timeout          - call FN(ARG) TICKS ticks from now, without a
+ *                    struct callout of one's own. It cannot be
+ *                    cancelled. Fails with ENOMEM.
+ */
+
+struct callout_wheel;	/* Opaque */
+
+struct callout {
+	void (*co_func)(void *);
+	void *co_arg;
+	unsigned co_expire;		/* hardclock count it is due at */
+	struct callout_wheel *co_wheel;	/* wheel it is on, if pending */
+	struct callout *co_next;
+	struct callout **co_pprev;
+};
+
+void callout_init(struct callout *c, void (*fn)(void *), void *arg);
+void callout_schedule(struct callout *c, unsigned ticks);
+bool callout_stop(struct callout *c);
+
+int timeout(void (*fn)(void *), void *arg, unsigned ticks);
+
+/*
+ * Used by the clock and thread code.
+ *
+ * callout_createwheel - make an empty wheel for a new CPU, with its
+ *                       time starting at NOW.
+ * callout_hardclock   - run everything on this CPU's wheel that is
+ *                       due as of its c_hardclocks.
+ * callout_nextevent   - if this CPU's wheel has anything on it, set
+ *                       *WHEN to a hardclock count no later than the
+ *                       first of them is due, and return true.
+ */
+struct callout_wheel *callout_createwheel(unsigned now);
+void callout_hardclock(void);
+bool callout_nextevent(unsigned *when);
+
+#endif /* _CALLOUT_H_ */
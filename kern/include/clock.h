@@ -35,11 +35,9 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
- *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * hardclock() is called on every CPU hz times a second, for
+ * scheduling and to run callouts (see callout.h), except while the
+ * CPU is idle (see hardclock_idle).
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -47,7 +45,7 @@
  * XXX we have struct timespec now, let's use it.
  */
 
-/* hardclocks per second */
+/* default hardclocks per second */
 #if OPT_SYNCHPROBS
 /* Make synchronization more exciting :) */
 #define HZ  10000
@@ -56,10 +54,34 @@
 #define HZ  100
 #endif
 
-void hardclock_bootstrap(void);
+/*
+ * hardclocks per second in effect. Starts out as HZ; hardclock_sethz
+ * changes it (the "hz" menu command, which can be given as a boot
+ * argument), failing with EINVAL outside HZ_MIN to HZ_MAX. Each CPU
+ * switches over at its next tick.
+ */
+#define HZ_MIN  10
+#define HZ_MAX  10000
+extern unsigned hz;
+int hardclock_sethz(unsigned newhz);
+
+/*
+ * The time page (see <kern/timepage.h>). timepage_bootstrap sets it up
+ * once the VM system is running; timepage_paddr returns the physical
+ * page for vm_fault to map.
+ */
+void timepage_bootstrap(void);
+paddr_t timepage_paddr(void);
 
 void hardclock(void);
-void timerclock(void);
+
+/*
+ * Tickless idle. An idle CPU calls hardclock_idle, with interrupts
+ * off, just before waiting for an interrupt, and hardclock_wake just
+ * after. In between, the clock tick is stopped.
+ */
+void hardclock_idle(void);
+void hardclock_wake(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
 
@@ -70,8 +92,6 @@ void getinterval(time_t secs1, uint32_t nsecs,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
- *
- *  this will be more efficient than clocknap() for longer sleeps
  */
 void clocksleep(int seconds);
 
@@ -34,8 +34,15 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include "opt-A3.h"
 
 
+/*
+ * Number of scheduling priority levels (see schedule() in thread.c).
+ * Level 0 runs first.
+ */
+#define SCHED_NLEVELS 4
+
 /*
  * Per-cpu structure
  *
@@ -59,14 +66,28 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_departing;	/* Threads not allowed to run here */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_ticks_skipped;	/* Ticks not taken while idle */
+	bool c_tickless;		/* Tick stopped (see hardclock_idle) */
+	unsigned c_tickless_len;	/* Ticks the idle timer was set for */
+	struct callout_wheel *c_callouts; /* Callouts to run on this cpu */
+	unsigned c_steals;		/* Threads taken from other cpus */
+	unsigned c_stealfails;		/* Steals given up on lock contention */
+	struct syscallstat *c_syscallstats; /* SCSTAT_NCALLS entries */
+#if OPT_A3
+	uint32_t c_asid_gen;		/* ASID generation of our TLB */
+	unsigned c_asid;		/* ASID currently in c0_entryhi */
+	unsigned c_tlb_next;		/* Next TLB slot vm_fault fills */
+#endif
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by level */
+	unsigned c_runcount;		/* Threads on all the run queues */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -82,10 +103,16 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * Each batch of shootdowns queued gets the next sequence
+	 * number; c_shootdown_done is the last one this cpu has
+	 * finished, which is what ipi_tlbshootdown_sync waits for.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_seq;
+	unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -109,6 +136,14 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Add up the system call statistics of all cpus into SUM, which has
+ * room for SCSTAT_NCALLS entries. Other cpus keep counting meanwhile,
+ * so the result is only a snapshot.
+ */
+struct syscallstat;
+void cpu_syscallstats(struct syscallstat *sum);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -152,6 +187,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_sync sends a batch of shootdowns to every CPU in
+ *    a mask (bit N is cpu number N), one IPI each, and waits until
+ *    they have all been done. Call it with interrupts on. It does not
+ *    leave out the current CPU; the caller does, before it can move.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +205,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_sync(uint32_t cpumask,
+			   const struct tlbshootdown *mappings, unsigned n);
 
 void interprocessor_interrupt(void);
 
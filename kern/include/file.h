@@ -0,0 +1,75 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * An openfile is what open() creates: a vnode plus the access mode
+ * and the seek position. Descriptors that share one (after dup2 or
+ * fork) share the position too; the openfile is reference counted
+ * and the vnode is closed when the last descriptor goes away.
+ *
+ * A filetable maps descriptors straight to openfiles. A process only
+ * ever has one thread, so the table itself needs no locking.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;			/* O_RDONLY, O_WRONLY or O_RDWR */
+	bool of_append;			/* O_APPEND: writes go at the end */
+	bool of_seekable;		/* false for the console and such */
+
+	/*
+	 * Protects of_offset across the I/O that uses it. Not taken
+	 * for objects that aren't seekable, so a process blocked
+	 * reading the console doesn't hold up others writing to it.
+	 */
+	struct lock *of_lock;
+	off_t of_offset;
+
+	struct spinlock of_reflock;	/* protects of_refcount */
+	unsigned of_refcount;
+};
+
+/*
+ * openfile_open  - open PATH (which may be scribbled on) with open(2)
+ *                  FLAGS; returns an openfile with one reference.
+ * openfile_incref, openfile_decref - add or drop a reference.
+ */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+struct filetable {
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+/*
+ * filetable_create  - make an empty table.
+ * filetable_copy    - make a table sharing every openfile in SRC (fork).
+ * filetable_destroy - close everything and free the table.
+ * filetable_get     - look up FD; EBADF if it isn't open.
+ * filetable_place   - put OF in the lowest free slot; EMFILE if full.
+ * filetable_setfd   - put OF in slot FD, returning what was there in
+ *                     *OLD (NULL if nothing) for the caller to drop.
+ * filetable_remove  - take FD out of the table and return it.
+ *
+ * The table takes over the caller's reference when an openfile is
+ * placed, and hands it back when one is removed.
+ */
+struct filetable *filetable_create(void);
+int filetable_copy(struct filetable *src, struct filetable **ret);
+void filetable_destroy(struct filetable *ft);
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_place(struct filetable *ft, struct openfile *of, int *fd);
+int filetable_setfd(struct filetable *ft, int fd, struct openfile *of,
+		    struct openfile **old);
+int filetable_remove(struct filetable *ft, int fd, struct openfile **ret);
+
+#endif /* _FILE_H_ */
@@ -0,0 +1,58 @@
+#ifndef _KERN_ASYNCRING_H_
+#define _KERN_ASYNCRING_H_
+
+/*
+ * Batched system calls.
+ *
+ * A process registers one struct asyncring, in its own memory, with
+ * asyncsetup(). It then fills in submission entries and advances
+ * ar_sqtail, and calls asyncsubmit() to have the kernel run every
+ * queued entry in one trap. For each entry the kernel posts a
+ * completion, in order, and advances ar_sqhead and ar_cqtail; the
+ * process consumes completions and advances ar_cqhead.
+ *
+ * The indices run freely and are taken modulo ASYNC_NENTRIES. The
+ * kernel stops early if the completion queue fills up, so there are
+ * never more than ASYNC_NENTRIES completions outstanding.
+ *
+ * Entries run one after another, in the calling thread; an entry that
+ * blocks (a read of the console, a waitpid) holds up the ones behind
+ * it.
+ */
+
+#define ASYNC_NENTRIES	64	/* ring size; a power of two */
+
+/* operations */
+#define ASYNC_READ	1	/* read(fd, buf, len) */
+#define ASYNC_WRITE	2	/* write(fd, buf, len) */
+#define ASYNC_CLOSE	3	/* close(fd) */
+#define ASYNC_WAITPID	4	/* waitpid(fd, buf, len): pid, status, options */
+
+struct asyncsqe {
+	__i32 sqe_op;		/* ASYNC_* */
+	__i32 sqe_fd;
+	void *sqe_buf;
+	__u32 sqe_len;
+	__u32 sqe_tag;		/* passed back in the completion */
+};
+
+struct asynccqe {
+	__u32 cqe_tag;		/* sqe_tag of the entry */
+	__i32 cqe_result;	/* what the call returned, or -1 */
+	__i32 cqe_errno;	/* the error, if cqe_result is -1 */
+};
+
+/*
+ * The kernel reads the four indices in one go, so they must stay
+ * together at the start.
+ */
+struct asyncring {
+	__u32 ar_sqhead;	/* next entry to run (kernel) */
+	__u32 ar_sqtail;	/* next entry to fill (process) */
+	__u32 ar_cqhead;	/* next completion to consume (process) */
+	__u32 ar_cqtail;	/* next completion to post (kernel) */
+	struct asyncsqe ar_sq[ASYNC_NENTRIES];
+	struct asynccqe ar_cq[ASYNC_NENTRIES];
+};
+
+#endif /* _KERN_ASYNCRING_H_ */
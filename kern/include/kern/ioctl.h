@@ -34,6 +34,14 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * Console line discipline. The argument is a pointer to an int: for
+ * TIOCGRAW the current setting is stored there, for TIOCSRAW it is
+ * read from there. Nonzero means raw mode, in which read() returns
+ * characters as they are typed, without echo or editing; zero (the
+ * default) means canonical mode, in which read() returns whole lines.
+ */
+#define TIOCGRAW	1	/* get raw mode */
+#define TIOCSRAW	2	/* set raw mode */
 
 #endif /* _KERN_IOCTL_H_*/
@@ -197,6 +197,14 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- OS/161 extensions --
+#define SYS_spawn        121
+#define SYS_syscallstats 122
+#define SYS_asyncsetup   123
+#define SYS_asyncsubmit  124
+#define SYS_setaffinity  125
+#define SYS_getaffinity  126
+
 /*CALLEND*/
 
 
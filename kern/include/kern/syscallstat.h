@@ -0,0 +1,28 @@
+#ifndef _KERN_SYSCALLSTAT_H_
+#define _KERN_SYSCALLSTAT_H_
+
+/*
+ * System call statistics, as returned by syscallstats().
+ *
+ * There is one struct syscallstat per call number (the SYS_* values in
+ * kern/syscall.h), summed over all CPUs. ss_count is bumped on entry;
+ * ss_errors and the latency histogram when the call returns, so calls
+ * that don't return (_exit, a successful execv) only show up in
+ * ss_count.
+ *
+ * Latency is wall-clock time spent in the handler, including any
+ * time asleep. Bucket 0 counts calls under 2 microseconds, bucket i
+ * calls of [2^i, 2^(i+1)) microseconds, and the last bucket
+ * everything longer.
+ */
+
+#define SCSTAT_NCALLS    128	/* more than the highest call number */
+#define SCSTAT_NBUCKETS  16
+
+struct syscallstat {
+	__u32 ss_count;				/* calls made */
+	__u32 ss_errors;			/* calls that failed */
+	__u32 ss_hist[SCSTAT_NBUCKETS];		/* latency histogram */
+};
+
+#endif /* _KERN_SYSCALLSTAT_H_ */
@@ -0,0 +1,26 @@
+#ifndef _KERN_TIMEPAGE_H_
+#define _KERN_TIMEPAGE_H_
+
+/*
+ * The time page.
+ *
+ * The kernel maps one read-only page at TIMEPAGE_VADDR into every
+ * user address space and stores the time of day in it on each clock
+ * tick, so programs can read the time without a system call. The
+ * time is only as fresh as the last tick (1/hz seconds; see clock.h).
+ *
+ * tp_gen is odd while an update is in progress. A reader notes it,
+ * reads the time, and checks it again; if it was odd or has changed,
+ * the time read may be torn and must be read again (or fetched with
+ * the __time system call instead).
+ */
+
+#define TIMEPAGE_VADDR  0x7ff00000
+
+struct timepage {
+	__time_t tp_secs;
+	__u32 tp_nsecs;
+	__u32 tp_gen;
+};
+
+#endif /* _KERN_TIMEPAGE_H_ */
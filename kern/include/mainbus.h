@@ -55,6 +55,20 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * This cpu's clock tick timer, which calls hardclock(). Normally it
+ * goes off every 1/hz seconds.
+ *
+ * mainbus_timer_set   - make the next tick come NTICKS ticks from now
+ *                       (at most mainbus_timer_maxticks()); the ones
+ *                       after that come every tick again.
+ * mainbus_timer_elapsed - whole ticks since the timer last went off
+ *                       or was set.
+ */
+void mainbus_timer_set(unsigned nticks);
+unsigned mainbus_timer_maxticks(void);
+unsigned mainbus_timer_elapsed(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
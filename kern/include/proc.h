@@ -43,22 +43,30 @@
 #include <limits.h>
 #include <array.h>
 #include <synch.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 
 struct addrspace;
 struct vnode;
+struct filetable;
+struct asyncring;
 #ifdef UW
 struct semaphore;
 #endif // UW
 
 
 #if OPT_A2
-//create proc array
-struct proc;
-#ifndef PROCINLINE
-#define PROCINLINE INLINE
-#endif
-DECLARRAY_BYTYPE(procarray, struct proc);
-DEFARRAY_BYTYPE(procarray, struct proc, PROCINLINE);
+/*
+ * What is left of a process between _exit and its parent's waitpid:
+ * just enough to answer the waitpid. The rest of the process is torn
+ * down as soon as it exits.
+ */
+struct zombie {
+	pid_t z_pid;
+	int z_status;			/* encoded with _MKWAIT_EXIT */
+	struct rusage z_rusage;
+	struct zombie *z_next;
+};
 #endif
 
 /*
@@ -77,7 +85,10 @@ struct proc {
 
 
 
-#ifdef UW
+#if OPT_A2
+	struct filetable *p_files;	/* open file descriptors */
+	struct asyncring *p_asyncring;	/* user address; see asyncsetup() */
+#elif defined(UW)
   /* a vnode to refer to the console device */
   /* this is a quick-and-dirty way to get console writes working */
   /* you will probably need to change this when implementing file-related
@@ -89,31 +100,74 @@ struct proc {
 	/* add more material here as needed */
 #if OPT_A2
     pid_t pid;
-    struct procarray child_proc;
-    bool can_exit; //false means can not exit
-    int exit_code;
-
-    struct proc *parent_proc;
-    struct lock *child_proc_lock;
-    struct lock *wait_pid_lock;
-    struct cv   *wait_pid_cv;
 
+    /*
+     * Family. p_familylock protects our child list, our zombie queue
+     * and our children's sibling links. Changing parent_proc takes
+     * both our lock and the parent's, so either is enough to read it.
+     * Take a child's lock before its parent's.
+     */
+    struct lock *p_familylock;
+    struct proc *parent_proc;	/* NULL once the parent has exited */
+    struct proc *p_children;	/* children still running */
+    struct proc *p_sibling_next;
+    struct proc **p_sibling_pprev;
+    struct zombie *p_zombies;	/* exited children not yet waited for */
+    struct zombie **p_zombietail;	/* end of p_zombies, oldest first */
+    struct cv *p_waitcv;	/* a child of ours has exited */
+
+    /* our own zombie record, allocated up front so _exit cannot fail */
+    struct zombie *p_zombie;
+    struct rusage p_rusage;
+
+    struct proc *p_hashnext;	/* next in this proc table bucket */
 #endif
 };
 
 
 #if OPT_A2
+/*
+ * PID allocation. pid_alloc returns 0 if every PID is in use. A PID
+ * given back with pid_free is not handed out again until the rest of
+ * the PID space has been cycled through.
+ */
+pid_t pid_alloc(void);
+void pid_free(pid_t pid);
+
+/*
+ * Global process table, hashed by PID, with a lock per bucket. It
+ * holds running processes only. proc_lookup_child finds process PID
+ * if it is a child of PARENT, else returns NULL. It does not take a
+ * reference: the caller must hold PARENT's p_familylock, which keeps
+ * the child from exiting until it is released.
+ */
+void proc_table_add(struct proc *proc);
+void proc_table_remove(struct proc *proc);
+struct proc *proc_lookup_child(pid_t pid, struct proc *parent);
 
-pid_t volatile process_id; //global value to track process_id
-struct array *pid_pool;
-struct lock  *pid_pool_lock;
 /*
- *not reuseable now, have trouble with array add and remove
- *TODO: fix later
+ * Parent/child bookkeeping.
+ *
+ * proc_adopt makes CHILD a child of PARENT (for fork).
+ * proc_exit leaves a zombie record with STATUS for the parent, orphans
+ * P's children and drops its unwaited-for zombies. After it returns
+ * P can be destroyed at once.
+ * proc_wait waits for the child PID of the current process (any child,
+ * if PID is WAIT_ANY) to exit and reaps it, copying its exit status out
+ * to STATUS and returning its PID in *RETPID, or fails with ECHILD. If
+ * the copyout fails the child is left to be waited for again. With
+ * WNOHANG in OPTIONS it returns at once, with *RETPID 0, if there is
+ * nothing to reap yet.
+ * proc_setaffinity, proc_getaffinity set or get the cpu affinity mask
+ * (see thread.h) of the threads of process PID, which must be the
+ * current process (PID 0 also means that) or a running child of it;
+ * otherwise they fail with ESRCH.
  */
-pid_t assign_pid(void);
-void add_pid_pool(pid_t pid);
-//struct proc get_child_process(procarray child_proc, pid_t pid);
+void proc_adopt(struct proc *parent, struct proc *child);
+void proc_exit(struct proc *p, int status);
+int proc_wait(pid_t pid, int options, userptr_t status, pid_t *retpid);
+int proc_setaffinity(pid_t pid, uint32_t mask);
+int proc_getaffinity(pid_t pid, uint32_t *mask);
 #endif
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -31,6 +31,7 @@
 #define _SYSCALL_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -47,6 +48,9 @@ void syscall(struct trapframe *tf);
 void pre_enter_forked_process(void *data1, unsigned long data2);
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(const_userptr_t program, userptr_t args);
+#if OPT_A3
+int sys_spawn(const_userptr_t program, userptr_t args, pid_t *retval);
+#endif
 #endif
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
@@ -62,12 +66,28 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_syscallstats(userptr_t buf, size_t nstats, int *retval);
+
+/* Print per-call counts and latencies (kernel menu). */
+void syscall_printstats(void);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+#if OPT_A2
+int sys_open(const_userptr_t upath, int flags, mode_t mode, int *retval);
+int sys_read(int fd, userptr_t ubuf, size_t nbytes, int *retval);
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_close(int fd);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_ioctl(int fd, int code, userptr_t data);
+int sys_asyncsetup(userptr_t ring);
+int sys_asyncsubmit(int *retval);
+int sys_setaffinity(pid_t pid, unsigned mask);
+int sys_getaffinity(pid_t pid, userptr_t mask);
+#endif
 
 #endif // UW
 
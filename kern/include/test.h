@@ -31,6 +31,7 @@
 #define _TEST_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 /*
  * Declarations for test code and other miscellaneous high-level
  * functions.
@@ -90,6 +91,13 @@ runprogram(char *progname, char **args);
 int
 runprogram(char *progname);
 #endif
+#if OPT_A2 && OPT_A3
+struct proc;
+struct argbuf;
+/* Start a user program in a new child process of PARENT (may be NULL). */
+int spawnprogram(char *progname, const struct argbuf *ab, struct proc *parent,
+		 pid_t *retpid);
+#endif
 /* Kernel menu system. */
 void menu(char *argstr);
 
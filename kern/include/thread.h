@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct wchan;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -83,6 +84,10 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_prio;		/* Scheduling level; 0 runs first */
+	unsigned t_ticks;		/* Hardclocks used of current quantum */
+	uint32_t t_affinity;		/* CPUs it may run on; see below */
+	struct wchan *t_sleepchan;	/* Just for clocksleep and clocknap */
 
 	/*
 	 * Interrupt state fields.
@@ -162,6 +167,44 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for a clock tick, and switch to another
+ * if its quantum is used up or a more urgent thread is waiting.
+ * Called from the timer interrupt.
+ */
+void thread_timeslice(void);
+
+/*
+ * CPU affinity.
+ *
+ * A thread's affinity mask has bit N set for each cpu number N it may
+ * run on (sys161 has at most 32 cpus). Threads start out with the
+ * mask of the thread that forked them, and the first one with
+ * CPUMASK_ALL. Within the mask, a thread waking up goes back to the
+ * cpu it last ran on unless that cpu has a backlog.
+ *
+ * thread_setaffinity fails with EINVAL if MASK names no cpu that
+ * exists. For the current thread it takes effect at once; for any
+ * other thread, the next time it is switched out or woken up.
+ */
+#define CPUMASK(n)	((uint32_t)1 << (n))
+#define CPUMASK_ALL	((uint32_t)0xffffffff)
+
+int thread_setaffinity(struct thread *t, uint32_t mask);
+uint32_t thread_getaffinity(struct thread *t);
+
+/*
+ * Print how many threads each CPU has queued at each level, and its
+ * work-stealing counts.
+ */
+void thread_printrunqueues(void);
+
+/*
+ * Print how many clock ticks each CPU has taken, and how many it
+ * skipped while idle.
+ */
+void thread_printticks(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -45,12 +45,28 @@
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
 #if OPT_A3
-struct coremap {
-    paddr_t paddr;
-    bool available;
-    bool contiguous;
-    int contiguous_frame_num;
+struct addrspace;
 
+/*
+ * One entry per physical frame managed by the buddy allocator in
+ * vm/coremap.c. Only the first frame of a block is meaningful:
+ * free blocks are linked by frame index on per-order free lists, and
+ * allocated blocks remember how many frames were handed out and, for
+ * user pages shared copy-on-write, how many address spaces map them.
+ * A user page mapped by exactly one address space also records which
+ * one and where, so the clock in swap.c can page it out.
+ */
+struct coremap {
+    bool available;             /* heads a block on a free list */
+    unsigned order;             /* log2 of the free block size */
+    int contiguous_frame_num;   /* frames in the allocation headed here */
+    unsigned refcount;          /* address spaces mapping this frame */
+    struct addrspace *owner;    /* sole user mapping, NULL if none/shared */
+    vaddr_t owner_vaddr;
+    bool referenced;            /* touched since the clock last passed */
+    bool busy;                  /* being paged out */
+    int next_free;              /* free list links (frame indices) */
+    int prev_free;
 };
 #endif
 /* Initialization function */
@@ -63,9 +79,38 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+#if OPT_A3
+/* Physical frame allocator, in coremap.c */
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+void coremap_free(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+void coremap_decref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void coremap_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+int coremap_clock_victims(paddr_t *victims, int max);
+void coremap_unbusy(paddr_t paddr);
+struct addrspace *coremap_owner(paddr_t paddr, vaddr_t *vaddr);
+void coremap_printstats(void);
+
+/* Swap space and page replacement, in swap.c */
+void swap_bootstrap(void);
+paddr_t swap_evict(void);
+int swap_read(unsigned slot, paddr_t paddr);
+void swap_incref(unsigned slot);
+void swap_decref(unsigned slot);
+void swap_lock_acquire(void);
+void swap_lock_release(void);
+#endif
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Invalidate N mappings here and on every CPU in CPUS, and wait */
+void vm_tlbshootdown_batch(uint32_t cpus, const struct tlbshootdown *ts,
+			   unsigned n);
+
 
 #endif /* _VM_H_ */
@@ -42,7 +42,6 @@
  * process that will have more than one thread is the kernel process.
  */
 #include "opt-A2.h"
-#define PROCINLINE
 
 #include <types.h>
 #include <proc.h>
@@ -51,7 +50,12 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <copyinout.h>
 #include <kern/fcntl.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/wait.h>
+#include <file.h>
 
 
 
@@ -60,6 +64,23 @@
  */
 struct proc *kproc;
 
+#if OPT_A2
+/*
+ * Process table: every user process from the time it gets its PID
+ * until it is freed, hashed by PID. Each bucket has its own spinlock,
+ * so forks and exits of unrelated processes on different CPUs rarely
+ * touch the same lock.
+ */
+#define PROC_HASH_SIZE 128
+
+static struct {
+	struct spinlock pb_lock;
+	struct proc *pb_head;
+} proc_table[PROC_HASH_SIZE];
+
+#define PROC_HASH(pid) ((unsigned)(pid) % PROC_HASH_SIZE)
+#endif
+
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
  */
@@ -103,26 +124,60 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-#ifdef UW
+#if OPT_A2
+	proc->p_files = NULL;
+	proc->p_asyncring = NULL;
+#elif defined(UW)
 	proc->console = NULL;
 #endif // UW
 
 #if OPT_A2
-	//lock_acquire(pid_pool_lock);
-	//proc->pid       = assign_pid();
-	///lock_release(pid_pool_lock);
-	proc->can_exit  = false;
-	proc->exit_code = 0;
-	procarray_init(&proc->child_proc);
-
-	proc->child_proc_lock = lock_create(name);
-	proc->parent_proc     = NULL;
-	proc->wait_pid_lock   = lock_create(name);
-	proc->wait_pid_cv     = cv_create(name);
+	proc->pid = 0;
+	proc->parent_proc = NULL;
+	proc->p_children = NULL;
+	proc->p_sibling_next = NULL;
+	proc->p_sibling_pprev = NULL;
+	proc->p_zombies = NULL;
+	proc->p_zombietail = &proc->p_zombies;
+	proc->p_zombie = NULL;
+	bzero(&proc->p_rusage, sizeof(proc->p_rusage));
+	proc->p_hashnext = NULL;
+
+	proc->p_familylock = lock_create(name);
+	if (proc->p_familylock == NULL) {
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	proc->p_waitcv = cv_create(name);
+	if (proc->p_waitcv == NULL) {
+		lock_destroy(proc->p_familylock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 #endif
 	return proc;
 }
 
+#if OPT_A2
+/*
+ * Free what proc_create set up, last thing in proc_destroy and when
+ * proc_create_runprogram fails partway.
+ */
+static
+void
+proc_free(struct proc *proc)
+{
+	cv_destroy(proc->p_waitcv);
+	lock_destroy(proc->p_familylock);
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	kfree(proc->p_name);
+	kfree(proc);
+}
+#endif
+
 
 /*
  * Destroy a proc structure.
@@ -145,92 +200,70 @@ proc_destroy(struct proc *proc)
 	DEBUG(DB_SYSCALL,"Proc_destroy: process %d \n",proc->pid);
 	DEBUG(DB_SYSCALL,"Proc_destroy: process name  %s \n",proc->p_name);
 #if OPT_A2
-	//TODO: better structure, it's messy now
-	//spinlock_acquire(proc->p_lock);
-	struct proc *parent_proc = proc->parent_proc;
-
-	// if the process has no parent, we can delete it safely
-	if (parent_proc == NULL) {
-
-		DEBUG(DB_SYSCALL,"Proc_destroy: %d 's parent is null\n",proc->pid);
-		lock_acquire(proc->child_proc_lock);
-		int len = procarray_num(&proc->child_proc);
-		DEBUG(DB_SYSCALL,"proc %d has %d child len: \n",proc->pid, len);
-		for (int i=0; i<len; i++) {
-			struct proc *child = procarray_get(&proc->child_proc, i);
-			spinlock_acquire(&child->p_lock);
-			DEBUG(DB_SYSCALL,"Proc_destroy: proc %d has child %d \n",proc->pid,child->pid);
-			if (child->can_exit) {
-				//if child can exit, set the child parent to null and delete it
-				child->parent_proc = NULL;
-				spinlock_release(&child->p_lock);
-				proc_destroy(child);
-			} else {
-				//child is not exitable, just set parent pointer to null
-			DEBUG(DB_SYSCALL,"Proc_destroy: %d  set it's child %d \n",proc->pid, child->pid);
-				child->parent_proc = NULL;
-				spinlock_release(&child->p_lock);
-			}
-		}
-		//destroy child_proc array, lock and cv
-		//TODO: have error on remove, cannot figure out
-		/*
-		for (int i=0; i<len; i++) {
-			struct proc *child = procarray_get(&proc->child_proc, i);
-			DEBUG(DB_SYSCALL,"child %d will be deleted\n",child->pid);
-			procarray_remove(&proc->child_proc,i);
-		}
-		*/
-		lock_release(proc->child_proc_lock);
-		lock_destroy(proc->child_proc_lock);
-		lock_destroy(proc->wait_pid_lock);
-		cv_destroy(proc->wait_pid_cv);
-
+	if (proc->p_zombie != NULL) {
+		struct proc *parent;
 
-		/* VFS fields */
-		if (proc->p_cwd) {
-			VOP_DECREF(proc->p_cwd);
-			proc->p_cwd = NULL;
-		}
-
-		if (proc->p_addrspace) {
-			struct addrspace *as;
-
-			as_deactivate();
-			as = curproc_setas(NULL);
-			as_destroy(as);
+		/*
+		 * Never got as far as _exit (fork or thread_fork failed),
+		 * so it is still in the table and its parent's child list.
+		 */
+		lock_acquire(proc->p_familylock);
+		KASSERT(proc->p_children == NULL && proc->p_zombies == NULL);
+		parent = proc->parent_proc;
+		if (parent != NULL) {
+			lock_acquire(parent->p_familylock);
+			*proc->p_sibling_pprev = proc->p_sibling_next;
+			if (proc->p_sibling_next != NULL) {
+				proc->p_sibling_next->p_sibling_pprev =
+					proc->p_sibling_pprev;
+			}
+			proc->parent_proc = NULL;
+			lock_release(parent->p_familylock);
 		}
+		proc_table_remove(proc);
+		lock_release(proc->p_familylock);
+		pid_free(proc->pid);
+		kfree(proc->p_zombie);
+	}
 
-		if (proc->console) {
-	  		vfs_close(proc->console);
-		}
+	/*
+	 * We don't take p_lock in here because we must have the only
+	 * reference to this structure.
+	 */
 
-		threadarray_cleanup(&proc->p_threads);
-		spinlock_cleanup(&proc->p_lock);
+	/* VFS fields */
+	if (proc->p_cwd) {
+		VOP_DECREF(proc->p_cwd);
+		proc->p_cwd = NULL;
+	}
 
-		P(proc_count_mutex);
-		KASSERT(proc_count > 0);
-		proc_count--;
-		/* signal the kernel menu thread if the process count has reached zero */
-		if (proc_count == 0) {
-	    	V(no_proc_sem);
-		}
-		V(proc_count_mutex);
+	if (proc->p_addrspace) {
+		/*
+		 * Only a process that never ran gets here with an address
+		 * space; sys__exit destroys its own. It is not curproc, so
+		 * don't go through curproc_setas.
+		 */
+		KASSERT(proc != curproc);
+		as_destroy(proc->p_addrspace);
+		proc->p_addrspace = NULL;
+	}
 
+	if (proc->p_files) {
+		filetable_destroy(proc->p_files);
+		proc->p_files = NULL;
+	}
 
-		//DEBUG(DB_SYSCALL,"pid to add is : process %d \n",(int)proc->pid);
-		add_pid_pool(proc->pid);
-		//lock_acquire(pid_pool_lock);
-		//DEBUG(DB_SYSCALL,"the address is  %d \n", &(proc->pid));
-		//array_add(pid_pool, &proc->pid, NULL);
-		//lock_release(pid_pool_lock);
-		DEBUG(DB_SYSCALL,"process %d is deleted \n",proc->pid);
-		kfree(proc->p_name);
-		kfree(proc);
+	P(proc_count_mutex);
+	KASSERT(proc_count > 0);
+	proc_count--;
+	/* signal the kernel menu thread if the process count has reached zero */
+	if (proc_count == 0) {
+		V(no_proc_sem);
 	}
-		DEBUG(DB_SYSCALL,"---------------------proc_destroy return---------------\n");
-	//delete child_proc array
+	V(proc_count_mutex);
 
+	DEBUG(DB_SYSCALL,"process %d is deleted \n",proc->pid);
+	proc_free(proc);
 
 #else
 	/*
@@ -304,17 +337,10 @@ void
 proc_bootstrap(void)
 {
 #if OPT_A2
-  //create pid_pool, not working now
-  DEBUG(DB_SYSCALL,"proc_bootstrap: starting\n");
-  process_id = PID_MIN;
-  pid_pool = array_create();
-  array_init(pid_pool);
-  //KASSERT(pid_pool != NULL);
-  pid_pool_lock = lock_create("pid_pool_lock");
-  if (pid_pool_lock == NULL) {
-  	panic("could not create pid pool lock");
+  for (int i=0; i<PROC_HASH_SIZE; i++) {
+    spinlock_init(&proc_table[i].pb_lock);
+    proc_table[i].pb_head = NULL;
   }
-  DEBUG(DB_SYSCALL,"proc_bootstrap: pid_pool generated\n");
 #endif
   kproc = proc_create("[kernel]");
   if (kproc == NULL) {
@@ -333,6 +359,56 @@ proc_bootstrap(void)
 #endif // UW
 }
 
+#if OPT_A2
+/*
+ * File descriptors for a new process: a copy of the current process's
+ * table (fork, spawn), or for a program started from the kernel menu,
+ * the console on descriptors 0, 1 and 2. Returns NULL if out of memory.
+ */
+static
+struct filetable *
+proc_inherit_files(void)
+{
+	struct filetable *ft;
+	struct openfile *of, *old;
+	char *console_path;
+	int fd;
+
+	if (curproc->p_files != NULL) {
+		if (filetable_copy(curproc->p_files, &ft)) {
+			return NULL;
+		}
+		return ft;
+	}
+
+	ft = filetable_create();
+	if (ft == NULL) {
+		return NULL;
+	}
+
+	/* open the console - this should always succeed */
+	console_path = kstrdup("con:");
+	if (console_path == NULL) {
+		filetable_destroy(ft);
+		return NULL;
+	}
+	if (openfile_open(console_path, O_RDWR, 0, &of)) {
+		panic("unable to open the console during process creation\n");
+	}
+	kfree(console_path);
+
+	/* one openfile shared by stdin, stdout and stderr */
+	for (fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+		if (fd != STDIN_FILENO) {
+			openfile_incref(of);
+		}
+		filetable_setfd(ft, fd, of, &old);
+		KASSERT(old == NULL);
+	}
+	return ft;
+}
+#endif
+
 /*
  * Create a fresh proc for use by runprogram.
  *
@@ -343,19 +419,43 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
+#if OPT_A2
+	pid_t pid;
+#else
 	char *console_path;
+#endif
+#if OPT_A2
+
+	pid = pid_alloc();
+	if (pid == 0) {
+		return NULL;
+	}
+#endif
 
 	proc = proc_create(name);
 	if (proc == NULL) {
+#if OPT_A2
+		pid_free(pid);
+#endif
 		return NULL;
 	}
-
-//have to assign pid here or thread is interrupted
 #if OPT_A2
-	proc->pid = assign_pid();
+	proc->p_zombie = kmalloc(sizeof(struct zombie));
+	proc->p_files = proc_inherit_files();
+	if (proc->p_zombie == NULL || proc->p_files == NULL) {
+		if (proc->p_files != NULL) {
+			filetable_destroy(proc->p_files);
+		}
+		kfree(proc->p_zombie);
+		proc_free(proc);
+		pid_free(pid);
+		return NULL;
+	}
+	proc->pid = pid;
+	proc_table_add(proc);
 #endif
 
-#ifdef UW
+#if !OPT_A2 && defined(UW)
 	/* open the console - this should always succeed */
 	console_path = kstrdup("con:");
 	if (console_path == NULL) {
@@ -494,44 +594,378 @@ curproc_setas(struct addrspace *newas)
 }
 
 #if OPT_A2
-pid_t assign_pid()
+/*
+ * PIDs in use, one bit each. Allocation is next-fit: the search starts
+ * just after the last PID handed out, so a freed PID is not reused
+ * until the allocator has gone all the way around, and skipping over a
+ * run of 32 busy PIDs costs one word compare.
+ */
+#define PID_WORDS ((PID_MAX + 32) / 32)
+
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+static uint32_t pid_map[PID_WORDS];
+static pid_t pid_next = PID_MIN;
+
+static
+bool
+pid_isset(pid_t pid)
+{
+	return (pid_map[pid / 32] & ((uint32_t)1 << (pid % 32))) != 0;
+}
+
+pid_t
+pid_alloc(void)
+{
+	pid_t pid;
+	int scanned;
+
+	spinlock_acquire(&pid_lock);
+	pid = pid_next;
+	for (scanned = 0; scanned <= PID_MAX - PID_MIN; scanned++) {
+		if (pid % 32 == 0 && pid_map[pid / 32] == 0xffffffff &&
+		    pid + 31 <= PID_MAX) {
+			/* whole word busy */
+			scanned += 31;
+			pid += 32;
+		}
+		else if (!pid_isset(pid)) {
+			pid_map[pid / 32] |= (uint32_t)1 << (pid % 32);
+			pid_next = pid == PID_MAX ? PID_MIN : pid + 1;
+			spinlock_release(&pid_lock);
+			return pid;
+		}
+		else {
+			pid++;
+		}
+		if (pid > PID_MAX) {
+			pid = PID_MIN;
+		}
+	}
+	spinlock_release(&pid_lock);
+	return 0;
+}
+
+void
+pid_free(pid_t pid)
+{
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+
+	spinlock_acquire(&pid_lock);
+	KASSERT(pid_isset(pid));
+	pid_map[pid / 32] &= ~((uint32_t)1 << (pid % 32));
+	spinlock_release(&pid_lock);
+}
+
+void
+proc_table_add(struct proc *proc)
+{
+	unsigned b = PROC_HASH(proc->pid);
+
+	spinlock_acquire(&proc_table[b].pb_lock);
+	proc->p_hashnext = proc_table[b].pb_head;
+	proc_table[b].pb_head = proc;
+	spinlock_release(&proc_table[b].pb_lock);
+}
+
+void
+proc_table_remove(struct proc *proc)
+{
+	unsigned b = PROC_HASH(proc->pid);
+	struct proc **pp;
+
+	spinlock_acquire(&proc_table[b].pb_lock);
+	for (pp = &proc_table[b].pb_head; *pp != NULL; pp = &(*pp)->p_hashnext) {
+		if (*pp == proc) {
+			*pp = proc->p_hashnext;
+			proc->p_hashnext = NULL;
+			spinlock_release(&proc_table[b].pb_lock);
+			return;
+		}
+	}
+	spinlock_release(&proc_table[b].pb_lock);
+	panic("proc_table_remove: process %d is not in the table\n",
+	      proc->pid);
+}
+
+struct proc *
+proc_lookup_child(pid_t pid, struct proc *parent)
+{
+	unsigned b = PROC_HASH(pid);
+	struct proc *proc;
+
+	/*
+	 * Check the parent while the bucket lock keeps PROC from being
+	 * freed. parent_proc can only become or stop being PARENT with
+	 * PARENT's family lock held.
+	 */
+	spinlock_acquire(&proc_table[b].pb_lock);
+	for (proc = proc_table[b].pb_head; proc != NULL; proc = proc->p_hashnext) {
+		if (proc->pid == pid) {
+			if (proc->parent_proc != parent) {
+				proc = NULL;
+			}
+			break;
+		}
+	}
+	spinlock_release(&proc_table[b].pb_lock);
+	return proc;
+}
+
+void
+proc_adopt(struct proc *parent, struct proc *child)
+{
+	lock_acquire(child->p_familylock);
+	lock_acquire(parent->p_familylock);
+	KASSERT(child->parent_proc == NULL);
+	child->parent_proc = parent;
+	child->p_sibling_next = parent->p_children;
+	child->p_sibling_pprev = &parent->p_children;
+	if (parent->p_children != NULL) {
+		parent->p_children->p_sibling_pprev = &child->p_sibling_next;
+	}
+	parent->p_children = child;
+	lock_release(parent->p_familylock);
+	lock_release(child->p_familylock);
+}
+
+/*
+ * Free a list of zombie records nobody is going to wait for.
+ */
+static
+void
+zombie_freelist(struct zombie *z)
+{
+	struct zombie *next;
+
+	while (z != NULL) {
+		next = z->z_next;
+		pid_free(z->z_pid);
+		kfree(z);
+		z = next;
+	}
+}
+
+void
+proc_exit(struct proc *p, int status)
+{
+	struct proc *child, *parent;
+	struct zombie *z, *unwaited;
+
+	lock_acquire(p->p_familylock);
+
+	/*
+	 * Nobody will wait for our children now. Clearing a child's
+	 * parent_proc needs its lock too, which goes against the lock
+	 * order, so only try for it. If the child has it, it is most
+	 * likely exiting and waiting for our lock to take itself off
+	 * the list; let it.
+	 */
+	while ((child = p->p_children) != NULL) {
+		if (!lock_tryacquire(child->p_familylock)) {
+			lock_release(p->p_familylock);
+			thread_yield();
+			lock_acquire(p->p_familylock);
+			continue;
+		}
+		p->p_children = child->p_sibling_next;
+		if (p->p_children != NULL) {
+			p->p_children->p_sibling_pprev = &p->p_children;
+		}
+		child->p_sibling_next = NULL;
+		child->p_sibling_pprev = NULL;
+		child->parent_proc = NULL;
+		lock_release(child->p_familylock);
+	}
+	unwaited = p->p_zombies;
+	p->p_zombies = NULL;
+	p->p_zombietail = &p->p_zombies;
+
+	/* from here on waitpid finds the zombie, not the process */
+	proc_table_remove(p);
+
+	z = p->p_zombie;
+	p->p_zombie = NULL;
+	parent = p->parent_proc;
+	if (parent != NULL) {
+		lock_acquire(parent->p_familylock);
+		*p->p_sibling_pprev = p->p_sibling_next;
+		if (p->p_sibling_next != NULL) {
+			p->p_sibling_next->p_sibling_pprev = p->p_sibling_pprev;
+		}
+		p->parent_proc = NULL;
+
+		z->z_pid = p->pid;
+		z->z_status = status;
+		z->z_rusage = p->p_rusage;
+		z->z_next = NULL;
+		*parent->p_zombietail = z;
+		parent->p_zombietail = &z->z_next;
+		z = NULL;
+		cv_broadcast(parent->p_waitcv, parent->p_familylock);
+		lock_release(parent->p_familylock);
+	}
+
+	lock_release(p->p_familylock);
+
+	zombie_freelist(unwaited);
+	if (z != NULL) {
+		/* orphan: nobody to report to, so the PID is free now */
+		pid_free(p->pid);
+		kfree(z);
+	}
+}
+
+/*
+ * Look up a running child of the current process. Call with our
+ * p_familylock held; that keeps it from exiting until released.
+ */
+static
+struct proc *
+proc_findchild(pid_t pid)
+{
+	KASSERT(lock_do_i_hold(curproc->p_familylock));
+	return proc_lookup_child(pid, curproc);
+}
+
+/*
+ * Find the zombie proc_wait should reap, and unlink it. Exited children
+ * are queued oldest first, so for WAIT_ANY it is the head of the queue.
+ */
+static
+struct zombie *
+proc_takezombie(struct proc *p, pid_t pid)
+{
+	struct zombie *z, **zp;
+
+	for (zp = &p->p_zombies; *zp != NULL; zp = &(*zp)->z_next) {
+		if (pid == WAIT_ANY || (*zp)->z_pid == pid) {
+			z = *zp;
+			*zp = z->z_next;
+			if (p->p_zombietail == &z->z_next) {
+				p->p_zombietail = zp;
+			}
+			return z;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put back a zombie proc_wait took but could not report. It goes at
+ * the head of the queue, where WAIT_ANY found it.
+ */
+static
+void
+proc_putzombie(struct proc *p, struct zombie *z)
+{
+	z->z_next = p->p_zombies;
+	if (p->p_zombies == NULL) {
+		p->p_zombietail = &z->z_next;
+	}
+	p->p_zombies = z;
+}
+
+int
+proc_wait(pid_t pid, int options, userptr_t status, pid_t *retpid)
 {
-	KASSERT(pid_pool_lock != NULL);
-	//TODO: strange error, fix later
-
-	lock_acquire(pid_pool_lock);
-	if (array_num(pid_pool) != 0) {
-		DEBUG(DB_SYSCALL, "pid_pool length is %d \n", array_num(pid_pool));
-		pid_t *pid = array_get(pid_pool, 0);
-		pid_t retval = *pid;
-		array_remove(pid_pool, 0);
-		kfree(pid);
-		DEBUG(DB_SYSCALL, "pid is %d \n", retval);
-		DEBUG(DB_SYSCALL, "pid_pool length is %d \n", array_num(pid_pool));
-		lock_release(pid_pool_lock);
-		return retval;
-	}
-
-	pid_t retval = process_id;
-	process_id = process_id + 1;
-	DEBUG(DB_SYSCALL, "pid is %d\n", retval);
-	lock_release(pid_pool_lock);
-	return retval;
+	struct proc *child;
+	struct zombie *z;
+	int result;
+
+	lock_acquire(curproc->p_familylock);
+	for (;;) {
+		z = proc_takezombie(curproc, pid);
+		if (z != NULL) {
+			lock_release(curproc->p_familylock);
+
+			/* a bad STATUS mustn't lose the child */
+			result = copyout(&z->z_status, status, sizeof(int));
+			if (result) {
+				lock_acquire(curproc->p_familylock);
+				proc_putzombie(curproc, z);
+				lock_release(curproc->p_familylock);
+				return result;
+			}
+			*retpid = z->z_pid;
+			pid_free(z->z_pid);
+			kfree(z);
+			return 0;
+		}
+
+		/* still running? it can't exit while we hold the lock */
+		if (pid == WAIT_ANY) {
+			child = curproc->p_children;
+		}
+		else {
+			child = proc_findchild(pid);
+		}
+		if (child == NULL) {
+			lock_release(curproc->p_familylock);
+			return ECHILD;
+		}
+		if (options & WNOHANG) {
+			lock_release(curproc->p_familylock);
+			*retpid = 0;
+			return 0;
+		}
+		cv_wait(curproc->p_waitcv, curproc->p_familylock);
+	}
 }
 
-void add_pid_pool(pid_t pid)
+int
+proc_setaffinity(pid_t pid, uint32_t mask)
 {
-	DEBUG(DB_SYSCALL,"**********add_pid_pool:  pid is %d**********\n",(int)pid);
-	pid_t *p = kmalloc(sizeof(pid_t));
-	*p = pid;
-	lock_acquire(pid_pool_lock);
-	array_add(pid_pool, p, NULL);
-	lock_release(pid_pool_lock);
-	//TEST
-	int n = array_num(pid_pool);
-	for(int i=0; i < n; i++) {
-		pid_t *num = array_get(pid_pool, i);
-		DEBUG(DB_SYSCALL,"pid is %d\n",(int)*num);
+	struct proc *child;
+	unsigned i, num;
+	int result;
+
+	if (pid == 0 || pid == curproc->pid) {
+		/* may move us, so don't hold anything */
+		return thread_setaffinity(curthread, mask);
+	}
+
+	lock_acquire(curproc->p_familylock);
+	child = proc_findchild(pid);
+	if (child == NULL) {
+		lock_release(curproc->p_familylock);
+		return ESRCH;
+	}
+	result = 0;
+	spinlock_acquire(&child->p_lock);
+	num = threadarray_num(&child->p_threads);
+	for (i=0; i<num && result == 0; i++) {
+		result = thread_setaffinity(
+			threadarray_get(&child->p_threads, i), mask);
+	}
+	spinlock_release(&child->p_lock);
+	lock_release(curproc->p_familylock);
+	return result;
+}
+
+int
+proc_getaffinity(pid_t pid, uint32_t *mask)
+{
+	struct proc *child;
+	int result;
+
+	if (pid == 0 || pid == curproc->pid) {
+		*mask = thread_getaffinity(curthread);
+		return 0;
+	}
+
+	lock_acquire(curproc->p_familylock);
+	child = proc_findchild(pid);
+	result = ESRCH;
+	if (child != NULL) {
+		spinlock_acquire(&child->p_lock);
+		if (threadarray_num(&child->p_threads) > 0) {
+			*mask = thread_getaffinity(
+				threadarray_get(&child->p_threads, 0));
+			result = 0;
+		}
+		spinlock_release(&child->p_lock);
 	}
+	lock_release(curproc->p_familylock);
+	return result;
 }
 #endif
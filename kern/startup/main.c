@@ -51,6 +51,11 @@
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 
+#include "opt-A3.h"
+#if OPT_A3
+#include <uw-vmstats.h>
+#endif
+
 
 /*
  * These two pieces of data are maintained by the makefiles and build system.
@@ -109,7 +114,6 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
-	hardclock_bootstrap();
 	vfs_bootstrap();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -123,6 +127,7 @@ boot(void)
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	timepage_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
 
@@ -147,6 +152,10 @@ shutdown(void)
 
 	kprintf("Shutting down.\n");
 
+#if OPT_A3
+	vmstats_print();
+#endif
+
 	vfs_clearbootfs();
 	vfs_clearcurdir();
 	vfs_unmountall();
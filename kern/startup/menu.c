@@ -42,11 +42,14 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <vm.h>
+#include <argbuf.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 /*
  * In-kernel menu and command dispatcher.
  */
@@ -83,7 +86,10 @@ getinterval(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2,
  *
  * It copies the program name because runprogram destroys the copy
  * it gets by passing it to vfs_open().
+ *
+ * Not used when the spawn path (OPT_A2 && OPT_A3) is available.
  */
+#if !(OPT_A2 && OPT_A3)
 static
 void
 cmd_progthread(void *ptr, unsigned long nargs)
@@ -125,6 +131,7 @@ cmd_progthread(void *ptr, unsigned long nargs)
 
 	/* NOTREACHED: runprogram only returns on error. */
 }
+#endif
 
 /*
  * Common code for cmd_prog and cmd_shell.
@@ -142,7 +149,12 @@ static
 int
 common_prog(int nargs, char **args)
 {
+#if OPT_A2 && OPT_A3
+	struct argbuf ab;
+	pid_t pid;
+#else
 	struct proc *proc;
+#endif
 	int result;
 
 #if OPT_SYNCHPROBS
@@ -150,6 +162,21 @@ common_prog(int nargs, char **args)
 		"synchronization-problems kernel.\n");
 #endif
 
+#if OPT_A2 && OPT_A3
+	args[nargs] = NULL;
+	/* same path as the spawn syscall; no parent to wait for it */
+	argbuf_init(&ab);
+	result = argbuf_fromkernel(&ab, args);
+	if (result == 0) {
+		result = spawnprogram(args[0], &ab, NULL, &pid);
+	}
+	argbuf_cleanup(&ab);
+	if (result) {
+		kprintf("Running program %s failed: %s\n", args[0],
+			strerror(result));
+		return result;
+	}
+#else
 	/* Create a process for the new program to run in. */
 	proc = proc_create_runprogram(args[0] /* name */);
 	if (proc == NULL) {
@@ -165,6 +192,7 @@ common_prog(int nargs, char **args)
 		proc_destroy(proc);
 		return result;
 	}
+#endif
 
 #ifdef UW
 	/* wait until the process we have just launched - and any others that it
@@ -406,6 +434,62 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if OPT_A3
+	coremap_printstats();
+#endif
+
+	return 0;
+}
+
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscall_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_runqueues(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printrunqueues();
+
+	return 0;
+}
+
+/*
+ * Command to show or set the clock tick rate. Given as a boot
+ * argument, this sets it before anything else runs.
+ */
+static
+int
+cmd_hz(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: hz [hardclocks-per-second]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		result = hardclock_sethz(atoi(args[1]));
+		if (result) {
+			kprintf("hz: must be %u to %u\n", HZ_MIN, HZ_MAX);
+			return result;
+		}
+	}
+
+	kprintf("%u hardclocks per second\n", hz);
+	thread_printticks();
 
 	return 0;
 }
@@ -533,6 +617,9 @@ static const char *mainmenu[] = {
 #endif
 	"[dth] Debug thread                  ",
 	"[kh] Kernel heap stats              ",
+	"[sc] System call stats              ",
+	"[rq] Run queue occupancy            ",
+	"[hz] Show/set clock tick rate       ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -590,6 +677,9 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "sc",		cmd_syscallstats },
+	{ "rq",		cmd_runqueues },
+	{ "hz",		cmd_hz },
 
 	/* base system tests */
 	{ "at",		arraytest },
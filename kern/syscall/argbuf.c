@@ -0,0 +1,205 @@
+/*
+ * Packed program arguments; see argbuf.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <argbuf.h>
+
+/* first allocation; most argument lists fit */
+#define ARGBUF_MIN 256
+
+void
+argbuf_init(struct argbuf *ab)
+{
+	ab->ab_buf = NULL;
+	ab->ab_len = 0;
+	ab->ab_max = 0;
+	ab->ab_nargs = 0;
+}
+
+void
+argbuf_cleanup(struct argbuf *ab)
+{
+	kfree(ab->ab_buf);
+	argbuf_init(ab);
+}
+
+/*
+ * Bytes of string data there is room for once the argv array for
+ * NARGS strings is accounted for.
+ */
+static
+size_t
+argbuf_limit(int nargs)
+{
+	size_t ptrbytes;
+
+	ptrbytes = (nargs + 1) * sizeof(userptr_t);
+	return ptrbytes < ARG_MAX ? ARG_MAX - ptrbytes : 0;
+}
+
+/*
+ * Make room for at least NEED bytes of strings in all. Doubling keeps
+ * the total copying linear in the final size.
+ */
+static
+int
+argbuf_reserve(struct argbuf *ab, size_t need)
+{
+	size_t newmax;
+	char *newbuf;
+
+	if (need <= ab->ab_max) {
+		return 0;
+	}
+
+	newmax = ab->ab_max > 0 ? ab->ab_max : ARGBUF_MIN;
+	while (newmax < need) {
+		newmax *= 2;
+	}
+	if (newmax > ARG_MAX) {
+		newmax = ARG_MAX;
+	}
+
+	newbuf = kmalloc(newmax);
+	if (newbuf == NULL) {
+		return ENOMEM;
+	}
+	if (ab->ab_len > 0) {
+		memcpy(newbuf, ab->ab_buf, ab->ab_len);
+	}
+	kfree(ab->ab_buf);
+	ab->ab_buf = newbuf;
+	ab->ab_max = newmax;
+	return 0;
+}
+
+int
+argbuf_fromuser(struct argbuf *ab, userptr_t uargv)
+{
+	userptr_t uarg;
+	size_t limit, room, len;
+	int result;
+
+	for (;;) {
+		result = copyin(uargv + ab->ab_nargs * sizeof(userptr_t),
+				&uarg, sizeof(uarg));
+		if (result) {
+			return result;
+		}
+		if (uarg == NULL) {
+			return 0;
+		}
+
+		limit = argbuf_limit(ab->ab_nargs + 1);
+		if (ab->ab_len >= limit) {
+			return E2BIG;
+		}
+
+		/*
+		 * We don't know how long the string is until it has been
+		 * copied, so copy into whatever room there is and grow
+		 * the buffer and retry if it didn't fit.
+		 */
+		for (;;) {
+			room = (ab->ab_max < limit ? ab->ab_max : limit) -
+				ab->ab_len;
+			if (room > 0) {
+				result = copyinstr((const_userptr_t)uarg,
+						   ab->ab_buf + ab->ab_len,
+						   room, &len);
+				if (result != ENAMETOOLONG) {
+					break;
+				}
+			}
+			if (ab->ab_max >= limit) {
+				return E2BIG;
+			}
+			result = argbuf_reserve(ab, ab->ab_max + 1);
+			if (result) {
+				return result;
+			}
+		}
+		if (result) {
+			return result;
+		}
+
+		ab->ab_len += len;
+		ab->ab_nargs++;
+	}
+}
+
+int
+argbuf_fromkernel(struct argbuf *ab, char **args)
+{
+	size_t total, len;
+	int nargs, i, result;
+
+	total = ab->ab_len;
+	for (nargs = 0; args[nargs] != NULL; nargs++) {
+		total += strlen(args[nargs]) + 1;
+	}
+	if (total > argbuf_limit(ab->ab_nargs + nargs)) {
+		return E2BIG;
+	}
+
+	result = argbuf_reserve(ab, total);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<nargs; i++) {
+		len = strlen(args[i]) + 1;
+		memcpy(ab->ab_buf + ab->ab_len, args[i], len);
+		ab->ab_len += len;
+	}
+	ab->ab_nargs += nargs;
+	return 0;
+}
+
+int
+argbuf_copyout(const struct argbuf *ab, vaddr_t *stackptr)
+{
+	userptr_t *argv;
+	vaddr_t strbase, sp;
+	size_t argvsize, pos;
+	int i, result;
+
+	/* the strings go at the top, as packed here */
+	strbase = *stackptr - ROUNDUP(ab->ab_len, 8);
+	if (ab->ab_len > 0) {
+		result = copyout(ab->ab_buf, (userptr_t)strbase, ab->ab_len);
+		if (result) {
+			return result;
+		}
+	}
+
+	argvsize = (ab->ab_nargs + 1) * sizeof(userptr_t);
+	argv = kmalloc(argvsize);
+	if (argv == NULL) {
+		return ENOMEM;
+	}
+	pos = 0;
+	for (i=0; i<ab->ab_nargs; i++) {
+		argv[i] = (userptr_t)(strbase + pos);
+		pos += strlen(ab->ab_buf + pos) + 1;
+	}
+	argv[ab->ab_nargs] = NULL;
+	KASSERT(pos == ab->ab_len);
+
+	/* and argv below them, leaving the stack 8-aligned */
+	sp = strbase - ROUNDUP(argvsize, 8);
+	result = copyout(argv, (userptr_t)sp, argvsize);
+	kfree(argv);
+	if (result) {
+		return result;
+	}
+
+	*stackptr = sp;
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Batched system calls; see <kern/asyncring.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/asyncring.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <current.h>
+#include <proc.h>
+#include <syscall.h>
+
+/* entries copied in (and completions out) at a time */
+#define ASYNC_BATCH 16
+
+/* the first four words of struct asyncring */
+struct asyncidx {
+  uint32_t sqhead;
+  uint32_t sqtail;
+  uint32_t cqhead;
+  uint32_t cqtail;
+};
+
+int
+sys_asyncsetup(userptr_t ring)
+{
+  struct asyncidx idx;
+  int result;
+
+  if (ring != NULL) {
+    if ((vaddr_t)ring % sizeof(uint32_t) != 0) {
+      return EINVAL;
+    }
+    /* make sure it's there */
+    result = copyin((const_userptr_t)ring, &idx, sizeof(idx));
+    if (result) {
+      return result;
+    }
+  }
+  curproc->p_asyncring = (struct asyncring *)ring;
+  return 0;
+}
+
+/*
+ * Run one entry.
+ */
+static
+void
+async_run(const struct asyncsqe *sqe, struct asynccqe *cqe)
+{
+  int ret = 0;
+  pid_t pid;
+  int result;
+
+  switch (sqe->sqe_op) {
+    case ASYNC_READ:
+      result = sys_read(sqe->sqe_fd, (userptr_t)sqe->sqe_buf,
+                        sqe->sqe_len, &ret);
+      break;
+    case ASYNC_WRITE:
+      result = sys_write(sqe->sqe_fd, (userptr_t)sqe->sqe_buf,
+                         sqe->sqe_len, &ret);
+      break;
+    case ASYNC_CLOSE:
+      result = sys_close(sqe->sqe_fd);
+      break;
+    case ASYNC_WAITPID:
+      result = sys_waitpid(sqe->sqe_fd, (userptr_t)sqe->sqe_buf,
+                           sqe->sqe_len, &pid);
+      ret = pid;
+      break;
+    default:
+      result = EINVAL;
+      break;
+  }
+
+  cqe->cqe_tag = sqe->sqe_tag;
+  cqe->cqe_result = result ? -1 : ret;
+  cqe->cqe_errno = result;
+}
+
+/*
+ * Store the kernel's side of the indices, sqhead and cqtail.
+ */
+static
+int
+async_publish(struct asyncring *ur, const struct asyncidx *idx)
+{
+  int result;
+
+  result = copyout(&idx->sqhead, (userptr_t)&ur->ar_sqhead,
+                   sizeof(idx->sqhead));
+  if (result == 0) {
+    result = copyout(&idx->cqtail, (userptr_t)&ur->ar_cqtail,
+                     sizeof(idx->cqtail));
+  }
+  return result;
+}
+
+int
+sys_asyncsubmit(int *retval)
+{
+  struct asyncring *ur = curproc->p_asyncring;	/* user address */
+  struct asyncsqe sqe[ASYNC_BATCH];
+  struct asynccqe cqe[ASYNC_BATCH];
+  struct asyncidx idx;
+  unsigned n, sqpos, cqpos, i;
+  int done = 0;
+  int result;
+
+  if (ur == NULL) {
+    return EINVAL;
+  }
+  result = copyin((const_userptr_t)ur, &idx, sizeof(idx));
+  if (result) {
+    return result;
+  }
+  if (idx.sqtail - idx.sqhead > ASYNC_NENTRIES ||
+      idx.cqtail - idx.cqhead > ASYNC_NENTRIES) {
+    return EINVAL;
+  }
+
+  /*
+   * An entry that has run must never be run again, so nothing may
+   * fail once a batch has started. Check up front that everything
+   * the kernel stores to can be written, by writing back what is
+   * there now.
+   */
+  result = async_publish(ur, &idx);
+  if (result) {
+    return result;
+  }
+
+  while (idx.sqhead != idx.sqtail &&
+         idx.cqtail - idx.cqhead < ASYNC_NENTRIES) {
+    /*
+     * Take as many entries as there are, and room for completions,
+     * up to a batch, without wrapping around either ring, so each
+     * side is a single copy.
+     */
+    sqpos = idx.sqhead % ASYNC_NENTRIES;
+    cqpos = idx.cqtail % ASYNC_NENTRIES;
+    n = idx.sqtail - idx.sqhead;
+    if (n > ASYNC_NENTRIES - (idx.cqtail - idx.cqhead)) {
+      n = ASYNC_NENTRIES - (idx.cqtail - idx.cqhead);
+    }
+    if (n > ASYNC_NENTRIES - sqpos) {
+      n = ASYNC_NENTRIES - sqpos;
+    }
+    if (n > ASYNC_NENTRIES - cqpos) {
+      n = ASYNC_NENTRIES - cqpos;
+    }
+    if (n > ASYNC_BATCH) {
+      n = ASYNC_BATCH;
+    }
+
+    result = copyin((const_userptr_t)&ur->ar_sq[sqpos], sqe,
+                    n * sizeof(struct asyncsqe));
+    if (result) {
+      return result;
+    }
+    result = copyin((const_userptr_t)&ur->ar_cq[cqpos], cqe,
+                    n * sizeof(struct asynccqe));
+    if (result == 0) {
+      result = copyout(cqe, (userptr_t)&ur->ar_cq[cqpos],
+                       n * sizeof(struct asynccqe));
+    }
+    if (result) {
+      return result;
+    }
+
+    for (i=0; i<n; i++) {
+      async_run(&sqe[i], &cqe[i]);
+    }
+    result = copyout(cqe, (userptr_t)&ur->ar_cq[cqpos],
+                     n * sizeof(struct asynccqe));
+    if (result) {
+      return result;
+    }
+
+    idx.sqhead += n;
+    idx.cqtail += n;
+    done += n;
+
+    /* let the process see how far we got, even if we fail later */
+    result = async_publish(ur, &idx);
+    if (result) {
+      return result;
+    }
+  }
+
+  *retval = done;
+  return 0;
+}
@@ -8,6 +8,235 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include "opt-A2.h"
+#if OPT_A2
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
+#include <limits.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <file.h>
+#endif
+
+#if OPT_A2
+/*
+ * Set up U to move LEN bytes between the user buffer UBUF and an
+ * object at OFFSET.
+ */
+static
+void
+uio_uinit(struct iovec *iov, struct uio *u, userptr_t ubuf, size_t len,
+	  off_t offset, enum uio_rw rw)
+{
+  iov->iov_ubase = ubuf;
+  iov->iov_len = len;
+  u->uio_iov = iov;
+  u->uio_iovcnt = 1;
+  u->uio_offset = offset;
+  u->uio_resid = len;
+  u->uio_segflg = UIO_USERSPACE;
+  u->uio_rw = rw;
+  u->uio_space = curproc->p_addrspace;
+}
+
+int
+sys_open(const_userptr_t upath, int flags, mode_t mode, int *retval)
+{
+  struct openfile *of;
+  char *path;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(upath, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+
+  //the only path lookup; read/write/lseek work on the openfile
+  result = openfile_open(path, flags, mode, &of);
+  kfree(path);
+  if (result) {
+    return result;
+  }
+
+  result = filetable_place(curproc->p_files, of, retval);
+  if (result) {
+    openfile_decref(of);
+    return result;
+  }
+  return 0;
+}
+
+/*
+ * read and write: the same apart from direction and access check.
+ */
+static
+int
+file_rw(int fd, userptr_t ubuf, size_t nbytes, enum uio_rw rw, int *retval)
+{
+  struct openfile *of;
+  struct iovec iov;
+  struct uio u;
+  struct stat st;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result) {
+    return result;
+  }
+  if (of->of_accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+    return EBADF;
+  }
+
+  if (!of->of_seekable) {
+    uio_uinit(&iov, &u, ubuf, nbytes, 0, rw);
+    result = rw == UIO_READ ? VOP_READ(of->of_vnode, &u) :
+                              VOP_WRITE(of->of_vnode, &u);
+  }
+  else {
+    lock_acquire(of->of_lock);
+    if (rw == UIO_WRITE && of->of_append) {
+      result = VOP_STAT(of->of_vnode, &st);
+      if (result) {
+        lock_release(of->of_lock);
+        return result;
+      }
+      of->of_offset = st.st_size;
+    }
+    uio_uinit(&iov, &u, ubuf, nbytes, of->of_offset, rw);
+    result = rw == UIO_READ ? VOP_READ(of->of_vnode, &u) :
+                              VOP_WRITE(of->of_vnode, &u);
+    of->of_offset = u.uio_offset;
+    lock_release(of->of_lock);
+  }
+  if (result) {
+    return result;
+  }
+
+  *retval = nbytes - u.uio_resid;
+  KASSERT(*retval >= 0);
+  return 0;
+}
+
+int
+sys_read(int fd, userptr_t ubuf, size_t nbytes, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fd,(unsigned int)ubuf,nbytes);
+  return file_rw(fd, ubuf, nbytes, UIO_READ, retval);
+}
+
+int
+sys_write(int fd, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fd,(unsigned int)ubuf,nbytes);
+  return file_rw(fd, ubuf, nbytes, UIO_WRITE, retval);
+}
+
+int
+sys_lseek(int fd, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result) {
+    return result;
+  }
+  if (!of->of_seekable) {
+    return ESPIPE;
+  }
+
+  lock_acquire(of->of_lock);
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    result = VOP_STAT(of->of_vnode, &st);
+    if (result) {
+      lock_release(of->of_lock);
+      return result;
+    }
+    newpos = st.st_size + pos;
+    break;
+  default:
+    lock_release(of->of_lock);
+    return EINVAL;
+  }
+  if (newpos < 0) {
+    lock_release(of->of_lock);
+    return EINVAL;
+  }
+  of->of_offset = newpos;
+  lock_release(of->of_lock);
+
+  *retval = newpos;
+  return 0;
+}
+
+int
+sys_close(int fd)
+{
+  struct openfile *of;
+  int result;
+
+  result = filetable_remove(curproc->p_files, fd, &of);
+  if (result) {
+    return result;
+  }
+  openfile_decref(of);
+  return 0;
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of, *old;
+  int result;
+
+  result = filetable_get(curproc->p_files, oldfd, &of);
+  if (result) {
+    return result;
+  }
+  if (newfd < 0 || newfd >= OPEN_MAX) {
+    return EBADF;
+  }
+  if (newfd != oldfd) {
+    openfile_incref(of);
+    result = filetable_setfd(curproc->p_files, newfd, of, &old);
+    KASSERT(result == 0);
+    if (old != NULL) {
+      openfile_decref(old);
+    }
+  }
+  *retval = newfd;
+  return 0;
+}
+
+int
+sys_ioctl(int fd, int code, userptr_t data)
+{
+  struct openfile *of;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result) {
+    return result;
+  }
+  return VOP_IOCTL(of->of_vnode, code, data);
+}
+
+#else
 
 /* handler for write() system call                  */
 /*
@@ -58,3 +287,4 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   KASSERT(*retval >= 0);
   return 0;
 }
+#endif /* OPT_A2 */
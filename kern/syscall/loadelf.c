@@ -60,6 +60,8 @@
 #include <vnode.h>
 #include <elf.h>
 
+#include "opt-A3.h"
+
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -81,9 +83,11 @@ load_segment(struct addrspace *as, struct vnode *v,
 	     size_t memsize, size_t filesize,
 	     int is_executable)
 {
+#if !OPT_A3
 	struct iovec iov;
 	struct uio u;
 	int result;
+#endif
 
 	if (filesize > memsize) {
 		kprintf("ELF: warning: segment filesize > segment memsize\n");
@@ -93,6 +97,12 @@ load_segment(struct addrspace *as, struct vnode *v,
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
+#if OPT_A3
+	/* Pages are read in by vm_fault on first touch. */
+	(void)is_executable;
+	return as_define_file(as, v, offset, vaddr, filesize);
+#else
+
 	iov.iov_ubase = (userptr_t)vaddr;
 	iov.iov_len = memsize;		 // length of the memory space
 	u.uio_iov = &iov;
@@ -143,24 +153,27 @@ load_segment(struct addrspace *as, struct vnode *v,
 #endif
 	
 	return result;
+#endif /* OPT_A3 */
 }
 
 /*
- * Load an ELF executable user program into the current address space.
+ * Load an ELF executable user program into address space AS.
  *
  * Returns the entry point (initial PC) for the program in ENTRYPOINT.
  */
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+load_elf(struct addrspace *as, struct vnode *v, vaddr_t *entrypoint)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
 
-	as = curproc_getas();
+#if !OPT_A3
+	/* segments are read straight into user memory */
+	KASSERT(as == curproc_getas());
+#endif
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -11,9 +11,13 @@
 #include <copyinout.h>
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <mips/trapframe.h>
 #include <kern/fcntl.h>
+#include <limits.h>
 #include <vfs.h>
+#include <test.h>
+#include <argbuf.h>
 
 #if OPT_A2
 void pre_enter_forked_process(void *data1, unsigned long data2)
@@ -46,17 +50,18 @@ int sys_fork(struct trapframe *tf, pid_t *retval)
   spinlock_acquire(&child_process->p_lock);
   child_process->p_addrspace = child_addrspace;
   spinlock_release(&child_process->p_lock);
+  //the ring is at the same place in the copy
+  child_process->p_asyncring = curproc->p_asyncring;
 
-  //assign PId, parent_proc and add child to child_proc
+  //assign PId and link the child into our family
   *retval = child_process->pid;
-  child_process->parent_proc = curproc;
-  procarray_add(&curproc->child_proc, child_process, NULL);
+  proc_adopt(curproc, child_process);
   DEBUG(DB_SYSCALL, "sys_fork: pid is %d \n",child_process->pid);
 
   //create thread
   struct trapframe *child_trapframe = kmalloc(sizeof(struct trapframe));
   if (child_trapframe == NULL) {
-    as_destroy(child_addrspace);
+    //proc_destroy takes the addrspace with it
     proc_destroy(child_process);
     return ENOMEM;
   }
@@ -64,7 +69,6 @@ int sys_fork(struct trapframe *tf, pid_t *retval)
   memcpy(child_trapframe, tf, sizeof(struct trapframe));
   int threadfork_retval = thread_fork(child_process->p_name, child_process, &pre_enter_forked_process, child_trapframe, 0);
   if (threadfork_retval) {
-    as_destroy(child_addrspace);
     kfree(child_trapframe);
     proc_destroy(child_process);
     return ENOMEM;
@@ -75,145 +79,124 @@ int sys_fork(struct trapframe *tf, pid_t *retval)
 
 int sys_execv(const_userptr_t program, userptr_t args)
 {
-  //TODO: Remember to free memory, tons of memory leak
+  struct argbuf ab;
+  struct addrspace *as, *old_as;
+  struct vnode *v;
+  vaddr_t entrypoint, stackptr;
+  char *program_path;
+  int nargs, result;
+
   DEBUG(DB_SYSEXECV, "--------------sys_execv--------------\n");
 
-  //copy program path into kernel
-  char *program_path;
-  size_t len;
-  program_path = kmalloc(sizeof(char) * PATH_MAX);
+  //copy program path and args into kernel
+  program_path = kmalloc(PATH_MAX);
   if (program_path == NULL) {
     return ENOMEM;
   }
-  int result = copyinstr(program, program_path, PATH_MAX, &len);
+  result = copyinstr(program, program_path, PATH_MAX, NULL);
   if (result) {
     kfree(program_path);
     return result;
   }
 
-  //count number of args and copy into kernel
-  int args_num = 0;
-
-  char **args_ptr  = (char **) args;
-  while (args_ptr[args_num] != NULL) {
-     DEBUG(DB_SYSEXECV, "args_ptr[%d] is %s\n", args_num, args_ptr[args_num]);
-    args_num++;
-  }
-  DEBUG(DB_SYSEXECV, "exit the loop\n");
-
-  //args_num++;
-  /*
-  userptr_t args_copy = kmalloc(sizeof(userptr_t));
-  if (args_copy == NULL) {
-    kfree(program_path);
-    return ENOMEM;
-  }
-  */
-  char **args_copy = kmalloc(args_num * sizeof(char *));
-  /*
-  result = copyin(args, args_copy, sizeof(char **));
+  argbuf_init(&ab);
+  result = argbuf_fromuser(&ab, args);
   if (result) {
+    argbuf_cleanup(&ab);
     kfree(program_path);
-    kfree(args_copy);
     return result;
   }
-  */
-
-  for (int i=0; i<args_num; i++) {
-    args_copy[i] = kmalloc(sizeof(char) * PATH_MAX);
-    result = copyinstr((const_userptr_t)args_ptr[i], args_copy[i], PATH_MAX, &len);
-    DEBUG(DB_SYSEXECV, "args_copy[%d] is %s\n", i, args_copy[i]);
-    if (result) {
-      kfree(program_path);
-      kfree(args);
-      return result;
-    }
-  }
-   DEBUG(DB_SYSEXECV, "after copyin\n");
-  args_copy[args_num] = NULL;
-
-  struct addrspace *as;
-  struct vnode *v;
-  vaddr_t entrypoint, stackptr;
+  DEBUG(DB_SYSEXECV, "sys_execv: %s, %d args in %u bytes\n",
+        program_path, ab.ab_nargs, ab.ab_len);
 
   /* Open the file. */
   result = vfs_open(program_path, O_RDONLY, 0, &v);
+  kfree(program_path);
   if (result) {
+    argbuf_cleanup(&ab);
     return result;
   }
 
-  /* We should be a new process. */
-  //KASSERT(curproc_getas() == NULL);
-
   /* Create a new address space. */
   as = as_create();
-  if (as ==NULL) {
+  if (as == NULL) {
     vfs_close(v);
+    argbuf_cleanup(&ab);
     return ENOMEM;
   }
 
   /* Switch to it and activate it. */
-  struct addrspace *old_addr = curproc_getas();
-  curproc_setas(as);
+  old_as = curproc_setas(as);
   as_activate();
 
   /* Load the executable. */
-  result = load_elf(v, &entrypoint);
-  if (result) {
-    /* p_addrspace will go away when curproc is destroyed */
-    vfs_close(v);
-    return result;
-  }
-
-  /* Done with the file now. */
+  result = load_elf(as, v, &entrypoint);
   vfs_close(v);
 
-  /* Define the user stack in the address space */
-  result = as_define_stack(as, &stackptr);
+  /* Define the user stack in the address space, and put the args on it */
+  if (result == 0) {
+    result = as_define_stack(as, &stackptr);
+  }
+  if (result == 0) {
+    result = argbuf_copyout(&ab, &stackptr);
+  }
+  nargs = ab.ab_nargs;
+  argbuf_cleanup(&ab);
+
   if (result) {
-    /* p_addrspace will go away when curproc is destroyed */
+    //go back to the old program, which is still intact
+    curproc_setas(old_as);
+    as_activate();
+    as_destroy(as);
     return result;
   }
 
-  //copy args back to user stack
-  DEBUG(DB_SYSEXECV, "get here\n");
-  char **args_stkptr = kmalloc(args_num * sizeof(char*));
-  //vaddr_t tmp_stackptr = stackptr;
-  int arg_len, aligned_len;
-
-  for (int i=args_num-1; i>=0; i--) {
-    arg_len = strlen(args_copy[i]) + 1;
-    aligned_len = ROUNDUP(arg_len, 4);
-    stackptr -= aligned_len;
-    result = copyoutstr(args_copy[i], (userptr_t)stackptr, arg_len, NULL);
-    if (result) {
-      return result;
-    }
-    DEBUG(DB_SYSEXECV, "args[%d] is %s\n", i, args_copy[i]);
-    args_stkptr[i] = (char *) stackptr;
-  }
-  args_stkptr[args_num] = NULL;
-  //len = args_num * sizeof(char*);
-  //result = copyout(args_ptr, (userptr_t)stackptr, len);
-  for (int i=args_num; i>=0; i--) {
-    aligned_len = ROUNDUP(sizeof(char *), 4);
-    stackptr -= aligned_len;
-    result = copyout(&args_stkptr[i], (userptr_t)stackptr, sizeof(char*));
-    if (result) {
-      return result;
-    }
-      //args_ptr[i] = (char *) stackptr;
-  }
-  //destory old addr_space
-  as_destroy(old_addr);
+  //destroy old addr_space, and forget anything registered in it
+  as_destroy(old_as);
+  curproc->p_asyncring = NULL;
+
   /* Warp to user mode. */
-  enter_new_process(args_num /*argc*/, (userptr_t) stackptr /*userspace addr of argv*/,
+  enter_new_process(nargs /*argc*/, (userptr_t)stackptr /*userspace addr of argv*/,
         stackptr, entrypoint);
 
-    /* enter_new_process does not return. */
+  /* enter_new_process does not return. */
   panic("enter_new_process returned\n");
   return EINVAL;
 }
+
+#if OPT_A3
+/*
+ * spawn: fork and execv in one step. The child's address space is
+ * built from the executable, so nothing of ours gets copied.
+ */
+int sys_spawn(const_userptr_t program, userptr_t args, pid_t *retval)
+{
+  struct argbuf ab;
+  char *path;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(program, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+
+  argbuf_init(&ab);
+  result = argbuf_fromuser(&ab, args);
+  if (result == 0) {
+    DEBUG(DB_SYSEXECV, "sys_spawn: %s with %d args\n", path, ab.ab_nargs);
+    result = spawnprogram(path, &ab, curproc, retval);
+  }
+
+  argbuf_cleanup(&ab);
+  kfree(path);
+  return result;
+}
+#endif /* OPT_A3 */
 #endif
 
 
@@ -226,12 +209,8 @@ void sys__exit(int exitcode) {
   struct proc *p = curproc;
   DEBUG(DB_SYSCALL,"process %d called exit\n",p->pid);
 #if OPT_A2
-  //change the exit status and wake up process wait on this id
-  lock_acquire(p->wait_pid_lock);
-  p->can_exit = true;
-  p->exit_code = _MKWAIT_EXIT(exitcode);
-  cv_broadcast(p->wait_pid_cv, p->wait_pid_lock);
-  lock_release(p->wait_pid_lock);
+  //leave a zombie record for the parent and wake it up
+  proc_exit(p, _MKWAIT_EXIT(exitcode));
 #else
   /* for now, just include this to keep the compiler from complaining about
      an unused variable */
@@ -283,6 +262,34 @@ sys_getpid(pid_t *retval)
   return(0);
 }
 
+#if OPT_A2
+/* pin a process (0 means ourselves) or one of our children to some cpus */
+int
+sys_setaffinity(pid_t pid, unsigned mask)
+{
+  if (pid < 0) {
+    return ESRCH;
+  }
+  return proc_setaffinity(pid, mask);
+}
+
+int
+sys_getaffinity(pid_t pid, userptr_t mask)
+{
+  uint32_t kmask;
+  int result;
+
+  if (pid < 0) {
+    return ESRCH;
+  }
+  result = proc_getaffinity(pid, &kmask);
+  if (result) {
+    return result;
+  }
+  return copyout(&kmask, mask, sizeof(kmask));
+}
+#endif
+
 /* stub handler for waitpid() system call                */
 
 int
@@ -291,9 +298,32 @@ sys_waitpid(pid_t pid,
 	    int options,
 	    pid_t *retval)
 {
-  int exitstatus;
   int result;
 
+  #if OPT_A2
+  //there are no stopped processes, so WUNTRACED changes nothing
+  if (options & ~(WNOHANG | WUNTRACED)) {
+    return EINVAL;
+  }
+  //no process groups either
+  if (pid != WAIT_ANY && (pid < PID_MIN || pid > PID_MAX)) {
+    return EINVAL;
+  }
+  DEBUG(DB_SYSCALL,"proc %d called wait_pid, wait on %d \n", curproc->pid, pid);
+  //blocks until the child has exited (unless WNOHANG), then copies out its status and reaps it
+  result = proc_wait(pid, options, status, &pid);
+  if (result) {
+    return result;
+  }
+  if (pid != 0) {
+    DEBUG(DB_SYSCALL, "sys_waitpid: parent %d reaped %d \n", curproc->pid, pid);
+  }
+  //else WNOHANG, and nobody has exited yet
+  *retval = pid;
+  return 0;
+  #else
+  int exitstatus;
+
   /* this is just a stub implementation that always reports an
      exit status of 0, regardless of the actual exit status of
      the specified process.
@@ -306,41 +336,8 @@ sys_waitpid(pid_t pid,
   if (options != 0) {
     return(EINVAL);
   }
-
-  #if OPT_A2
-  if (pid < PID_MIN || pid > PID_MAX) {
-    return EINVAL;
-  }
-  struct proc *parent_proc = curproc;
-  DEBUG(DB_SYSCALL,"proc %d called wait_pid, wait on %d \n", parent_proc->pid, pid);
-  //check is process call its own children
-  struct proc *child_proc = NULL;
-  lock_acquire(parent_proc->child_proc_lock);
-  int len = procarray_num(&parent_proc->child_proc);
-  for(int i=0; i<len; i++) {
-    struct proc *childarray_proc = procarray_get(&parent_proc->child_proc, i);
-    if (childarray_proc->pid == pid) {
-      child_proc = childarray_proc;
-      break;
-    }
-  }
-  lock_release(parent_proc->child_proc_lock);
-  if (child_proc == NULL) {
-    return ECHILD;
-  }
-  //wait child_proc exit
-  lock_acquire(child_proc->wait_pid_lock);
-  while (child_proc->can_exit == false) {
-    DEBUG(DB_SYSCALL, "sys_waitpid: parent is wait for %d to exit\n", child_proc->pid);
-    cv_wait(child_proc->wait_pid_cv, child_proc->wait_pid_lock);
-  }
-   DEBUG(DB_SYSCALL, "sys_waitpid: parent %d is wake up \n", parent_proc->pid);
-  lock_release(child_proc->wait_pid_lock);
-  exitstatus = child_proc->exit_code;
-  #else
   /* for now, just pretend the exitstatus is 0 */
   exitstatus = 0;
-  #endif
 
   result = copyout((void *)&exitstatus,status,sizeof(int));
   if (result) {
@@ -348,5 +345,6 @@ sys_waitpid(pid_t pid,
   }
   *retval = pid;
   return(0);
+  #endif
 }
 
@@ -46,7 +46,11 @@
 #include <test.h>
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <copyinout.h>
+#include <thread.h>
+#include <argbuf.h>
+
 /*
  * Load program "progname" and start running it in usermode.
  * Does not return except on error.
@@ -88,7 +92,7 @@ runprogram(char *progname)
 	as_activate();
 
 	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
+	result = load_elf(as, v, &entrypoint);
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
@@ -106,47 +110,21 @@ runprogram(char *progname)
 	}
 
 #if OPT_A2
-	  //count number of args and copy into kernel
-  	int args_num = 0;
-  	while (args[args_num] != NULL) {
-    	args_num++;
-  	}
-  	DEBUG(DB_SYSEXECV, "args_num is %d\n", args_num);
-
-  	//copy args to stack, align pointer to 4
-
-    //ROUNDUP(stackptr, 8);
-  	char **args_ptr = kmalloc(args_num * sizeof(char*));
-  	//vaddr_t tmp_stackptr = stackptr;
-  	int arg_len, aligned_len;
-
-  	for (int i=args_num-1; i>=0; i--) {
-  		arg_len = strlen(args[i]) + 1;
-  		aligned_len = ROUNDUP(arg_len, 4);
-  		stackptr -= aligned_len;
-  		result = copyoutstr(args[i], (userptr_t)stackptr, arg_len, NULL);
-  		if (result) {
-  			return result;
-  		}
-  		DEBUG(DB_SYSEXECV, "args[%d] is %s\n", i, args[i]);
-  		args_ptr[i] = (char *) stackptr;
-  	}
-  	args_ptr[args_num] = NULL;
-
-  	//len = args_num * sizeof(char*);
-  	//result = copyout(args_ptr, (userptr_t)stackptr, len);
-  	for (int i=args_num; i>=0; i--) {
-  		aligned_len = ROUNDUP(sizeof(char *), 4);
-  		stackptr -= aligned_len;
-  		result = copyout(&args_ptr[i], (userptr_t)stackptr, sizeof(char*));
-  		if (result) {
-  			return result;
-  		}
-  		//args_ptr[i] = (char *) stackptr;
-  	}
-  	DEBUG(DB_SYSEXECV, "size of vaddr_t %d\n", sizeof(vaddr_t));
-  	DEBUG(DB_SYSEXECV, "size of char * %d\n", sizeof(char *));
-  	DEBUG(DB_SYSEXECV, "reached here\n");
+	struct argbuf ab;
+	int args_num;
+
+	argbuf_init(&ab);
+	result = argbuf_fromkernel(&ab, args);
+	if (result == 0) {
+		result = argbuf_copyout(&ab, &stackptr);
+	}
+	args_num = ab.ab_nargs;
+	argbuf_cleanup(&ab);
+	if (result) {
+		return result;
+	}
+	DEBUG(DB_SYSEXECV, "args_num is %d\n", args_num);
+
 	/* Warp to user mode. */
 	enter_new_process(args_num /*argc*/, (userptr_t)stackptr /*userspace addr of argv*/,
 			  stackptr, entrypoint);
@@ -160,3 +138,155 @@ runprogram(char *progname)
 	return EINVAL;
 }
 
+
+#if OPT_A2 && OPT_A3
+/*
+ * Everything the first thread of a spawned process needs to get to
+ * user mode.
+ */
+struct spawninfo {
+	vaddr_t si_entrypoint;
+	vaddr_t si_stackptr;
+	int si_nargs;
+};
+
+/*
+ * First thread of a spawned process: its address space is already
+ * loaded and its arguments are on the stack.
+ */
+static
+void
+spawn_thread(void *data1, unsigned long data2)
+{
+	struct spawninfo *si = data1;
+	vaddr_t stackptr, entrypoint;
+	int nargs;
+
+	(void)data2;
+
+	as_activate();
+
+	stackptr = si->si_stackptr;
+	entrypoint = si->si_entrypoint;
+	nargs = si->si_nargs;
+	kfree(si);
+
+	enter_new_process(nargs, (userptr_t)stackptr, stackptr, entrypoint);
+	panic("enter_new_process returned\n");
+}
+
+/*
+ * Copy the arguments in AB onto the stack of AS, which is not running
+ * yet, moving *STACKPTR down past them. copyout only goes to the
+ * current address space, so the calling process (or kproc) has AS
+ * lent to it meanwhile.
+ */
+static
+int
+spawn_copyargs(struct addrspace *as, const struct argbuf *ab,
+	       vaddr_t *stackptr)
+{
+	struct addrspace *oldas;
+	int result;
+
+	oldas = curproc_setas(as);
+	as_activate();
+	result = argbuf_copyout(ab, stackptr);
+	curproc_setas(oldas);
+	as_activate();
+	return result;
+}
+
+/*
+ * Start PROGNAME with arguments AB in a brand new process, without
+ * going through fork: the executable is loaded straight into a fresh
+ * address space, so the cost doesn't depend on the caller's size. The
+ * new process becomes a child of PARENT, or has no parent if PARENT is
+ * NULL. Its pid is returned in RETPID.
+ *
+ * Everything that can fail is done before the new process starts, so
+ * errors come back from here. The caller keeps PROGNAME and AB.
+ */
+int
+spawnprogram(char *progname, const struct argbuf *ab, struct proc *parent,
+	     pid_t *retpid)
+{
+	struct spawninfo *si;
+	struct proc *proc;
+	struct addrspace *as;
+	struct vnode *v;
+	char *path;
+	int result;
+
+	si = kmalloc(sizeof(struct spawninfo));
+	if (si == NULL) {
+		return ENOMEM;
+	}
+	si->si_nargs = ab->ab_nargs;
+
+	/* vfs_open may scribble on the path */
+	path = kstrdup(progname);
+	if (path == NULL) {
+		kfree(si);
+		return ENOMEM;
+	}
+	result = vfs_open(path, O_RDONLY, 0, &v);
+	kfree(path);
+	if (result) {
+		kfree(si);
+		return result;
+	}
+
+	as = as_create();
+	if (as == NULL) {
+		vfs_close(v);
+		kfree(si);
+		return ENOMEM;
+	}
+
+	result = load_elf(as, v, &si->si_entrypoint);
+	vfs_close(v);
+	if (result == 0) {
+		result = as_define_stack(as, &si->si_stackptr);
+	}
+	if (result) {
+		as_destroy(as);
+		kfree(si);
+		return result;
+	}
+
+	proc = proc_create_runprogram(progname);
+	if (proc == NULL) {
+		as_destroy(as);
+		kfree(si);
+		return ENOMEM;
+	}
+	/* from here on proc_destroy takes the address space with it */
+	proc->p_addrspace = as;
+
+	/* faults while we fill in the stack are the new process's */
+	as->as_proc = proc;
+	result = spawn_copyargs(as, ab, &si->si_stackptr);
+	as->as_proc = NULL;
+	if (result) {
+		kfree(si);
+		proc_destroy(proc);
+		return result;
+	}
+
+	if (parent != NULL) {
+		proc_adopt(parent, proc);
+	}
+
+	/* read this now; an orphan may be gone as soon as it is running */
+	*retpid = proc->pid;
+
+	result = thread_fork(proc->p_name, proc, spawn_thread, si, 0);
+	if (result) {
+		kfree(si);
+		proc_destroy(proc);
+		return result;
+	}
+	return 0;
+}
+#endif /* OPT_A2 && OPT_A3 */
@@ -0,0 +1,331 @@
+/*
+ * Callouts and the per-cpu timer wheels; see callout.h.
+ *
+ * A wheel has CW_LEVELS levels of CW_SLOTS slots. Level 0 has a slot
+ * for each of the next CW_SLOTS ticks; a slot of level L stands for
+ * CW_SLOTS^L ticks. A callout goes in the lowest level whose range
+ * reaches its expiry time. Each time level L comes round to slot 0,
+ * the next slot of level L+1 is emptied and its callouts put back in,
+ * which drops them a level or more. So a callout is moved at most
+ * CW_LEVELS-1 times before it runs, and a tick costs O(1) plus the
+ * callouts actually due then.
+ *
+ * A wheel is only advanced by its own cpu's hardclock, but callouts
+ * can be stopped from anywhere, so each wheel has a lock. Callout
+ * functions are called with it released.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <callout.h>
+
+#define CW_BITS		6
+#define CW_SLOTS	(1U << CW_BITS)
+#define CW_MASK		(CW_SLOTS - 1)
+#define CW_LEVELS	4
+
+/* How far ahead the wheel reaches. Later callouts wait at the top. */
+#define CW_RANGE	(1U << (CW_BITS * CW_LEVELS))
+
+/* log2 of the ticks one slot of LEVEL stands for */
+#define CW_SHIFT(level)	(CW_BITS * (level))
+
+struct callout_wheel {
+	struct spinlock cw_lock;
+	unsigned cw_now;		/* hardclock count processed up to */
+	unsigned cw_count;		/* number of callouts pending */
+	struct callout *cw_slots[CW_LEVELS][CW_SLOTS];
+};
+
+struct callout_wheel *
+callout_createwheel(unsigned now)
+{
+	struct callout_wheel *w;
+	unsigned i, j;
+
+	w = kmalloc(sizeof(*w));
+	if (w == NULL) {
+		return NULL;
+	}
+	spinlock_init(&w->cw_lock);
+	w->cw_now = now;
+	w->cw_count = 0;
+	for (i=0; i<CW_LEVELS; i++) {
+		for (j=0; j<CW_SLOTS; j++) {
+			w->cw_slots[i][j] = NULL;
+		}
+	}
+	return w;
+}
+
+static
+void
+callout_link(struct callout **head, struct callout *c)
+{
+	c->co_next = *head;
+	c->co_pprev = head;
+	if (*head != NULL) {
+		(*head)->co_pprev = &c->co_next;
+	}
+	*head = c;
+}
+
+static
+void
+callout_unlink(struct callout *c)
+{
+	*c->co_pprev = c->co_next;
+	if (c->co_next != NULL) {
+		c->co_next->co_pprev = c->co_pprev;
+	}
+	c->co_next = NULL;
+	c->co_pprev = NULL;
+}
+
+/*
+ * Put C in the slot for its expiry time. Call with the wheel locked.
+ */
+static
+void
+cw_insert(struct callout_wheel *w, struct callout *c)
+{
+	unsigned expire, delta, level;
+
+	expire = c->co_expire;
+	delta = expire - w->cw_now;
+	if ((int)delta < (int)CW_SLOTS) {
+		/* this tick's slot, if it's already due */
+		level = 0;
+		if ((int)delta < 0) {
+			expire = w->cw_now;
+		}
+	}
+	else {
+		if (delta >= CW_RANGE) {
+			/* park it in the furthest slot; it gets moved on */
+			delta = CW_RANGE - 1;
+			expire = w->cw_now + delta;
+		}
+		for (level = 1; delta >> CW_SHIFT(level + 1) != 0; level++) {
+			/* nothing */
+		}
+	}
+	callout_link(&w->cw_slots[level][(expire >> CW_SHIFT(level)) & CW_MASK],
+		     c);
+}
+
+/*
+ * Advance the wheel one tick, moving down callouts from the upper
+ * levels that have come round to their next slot.
+ */
+static
+void
+cw_tick(struct callout_wheel *w)
+{
+	struct callout *list, *c;
+	unsigned now, top, level;
+
+	w->cw_now++;
+	now = w->cw_now;
+
+	top = 0;
+	while (top + 1 < CW_LEVELS &&
+	       (now & ((1U << CW_SHIFT(top + 1)) - 1)) == 0) {
+		top++;
+	}
+	for (level = top; level > 0; level--) {
+		list = w->cw_slots[level][(now >> CW_SHIFT(level)) & CW_MASK];
+		w->cw_slots[level][(now >> CW_SHIFT(level)) & CW_MASK] = NULL;
+		while ((c = list) != NULL) {
+			list = c->co_next;
+			cw_insert(w, c);
+		}
+	}
+}
+
+void
+callout_hardclock(void)
+{
+	struct callout_wheel *w;
+	struct callout *due, *c;
+	struct callout **slot;
+	void (*func)(void *);
+	void *arg;
+
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->cw_lock);
+	/* more than one tick if we were idle without ticking */
+	while (w->cw_now != curcpu->c_hardclocks) {
+		if (w->cw_count == 0) {
+			w->cw_now = curcpu->c_hardclocks;
+			break;
+		}
+		cw_tick(w);
+
+		/*
+		 * Everything in this tick's slot is due. Take the slot
+		 * over, so the functions can stop and schedule
+		 * callouts, including each other, as they run.
+		 */
+		slot = &w->cw_slots[0][w->cw_now & CW_MASK];
+		due = *slot;
+		*slot = NULL;
+		if (due != NULL) {
+			due->co_pprev = &due;
+		}
+		while ((c = due) != NULL) {
+			KASSERT((int)(c->co_expire - w->cw_now) <= 0);
+			callout_unlink(c);
+			c->co_wheel = NULL;
+			w->cw_count--;
+			func = c->co_func;
+			arg = c->co_arg;
+
+			spinlock_release(&w->cw_lock);
+			func(arg);
+			spinlock_acquire(&w->cw_lock);
+		}
+	}
+	spinlock_release(&w->cw_lock);
+}
+
+/*
+ * The soonest a callout on this wheel can run is when the first
+ * nonempty slot of some level comes round. That may be when it only
+ * moves down a level, but it's never too late, which is what matters
+ * for tickless idle.
+ */
+bool
+callout_nextevent(unsigned *when)
+{
+	struct callout_wheel *w;
+	unsigned level, base, k, soonest, ticks;
+
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->cw_lock);
+	if (w->cw_count == 0) {
+		spinlock_release(&w->cw_lock);
+		return false;
+	}
+	soonest = CW_RANGE;
+	for (level = 0; level < CW_LEVELS; level++) {
+		base = w->cw_now >> CW_SHIFT(level);
+		for (k=1; k<=CW_SLOTS; k++) {
+			if (w->cw_slots[level][(base + k) & CW_MASK] != NULL) {
+				ticks = ((base + k) << CW_SHIFT(level)) -
+					w->cw_now;
+				if (ticks < soonest) {
+					soonest = ticks;
+				}
+				break;
+			}
+		}
+	}
+	*when = w->cw_now + soonest;
+	spinlock_release(&w->cw_lock);
+	return true;
+}
+
+void
+callout_init(struct callout *c, void (*fn)(void *), void *arg)
+{
+	c->co_func = fn;
+	c->co_arg = arg;
+	c->co_expire = 0;
+	c->co_wheel = NULL;
+	c->co_next = NULL;
+	c->co_pprev = NULL;
+}
+
+void
+callout_schedule(struct callout *c, unsigned ticks)
+{
+	struct callout_wheel *w;
+	int spl;
+
+	/* far enough from wrapping around that expiry times compare */
+	KASSERT(ticks > 0 && ticks < 0x40000000);
+	callout_stop(c);
+
+	/*
+	 * Don't switch cpus before it's on this cpu's wheel: if it
+	 * landed on an idle cpu's wheel, that cpu wouldn't know to
+	 * wake up for it.
+	 */
+	spl = splhigh();
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->cw_lock);
+	c->co_expire = curcpu->c_hardclocks + ticks;
+	c->co_wheel = w;
+	cw_insert(w, c);
+	w->cw_count++;
+	spinlock_release(&w->cw_lock);
+	splx(spl);
+}
+
+bool
+callout_stop(struct callout *c)
+{
+	struct callout_wheel *w;
+	bool pending;
+
+	w = c->co_wheel;
+	if (w == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&w->cw_lock);
+	/* it may have run while we were getting the lock */
+	pending = c->co_wheel == w;
+	if (pending) {
+		callout_unlink(c);
+		c->co_wheel = NULL;
+		w->cw_count--;
+	}
+	spinlock_release(&w->cw_lock);
+	return pending;
+}
+
+/*
+ * timeout() keeps its callout in one of these, freed when it runs.
+ */
+struct timeout {
+	struct callout to_callout;
+	void (*to_func)(void *);
+	void *to_arg;
+};
+
+static
+void
+timeout_run(void *data)
+{
+	struct timeout *to = data;
+	void (*func)(void *);
+	void *arg;
+
+	func = to->to_func;
+	arg = to->to_arg;
+	kfree(to);
+	func(arg);
+}
+
+int
+timeout(void (*fn)(void *), void *arg, unsigned ticks)
+{
+	struct timeout *to;
+
+	to = kmalloc(sizeof(*to));
+	if (to == NULL) {
+		return ENOMEM;
+	}
+	to->to_func = fn;
+	to->to_arg = arg;
+	callout_init(&to->to_callout, timeout_run, to);
+	callout_schedule(&to->to_callout, ticks);
+	return 0;
+}
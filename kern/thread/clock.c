@@ -28,20 +28,26 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/timepage.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
+#include <mainbus.h>
+#include <callout.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
+#include <vm.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Things that have to happen at some point in the future, including
+ * waking up threads in clocksleep and clocknap, are callouts (see
+ * callout.h), run from hardclock.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,65 +57,143 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	25	/* Age run queues every 25 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
+unsigned hz = HZ;
+
+int
+hardclock_sethz(unsigned newhz)
+{
+	if (newhz < HZ_MIN || newhz > HZ_MAX) {
+		return EINVAL;
+	}
+	hz = newhz;
+	return 0;
+}
+
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-/*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * The time page, in kernel (kseg0) space.
  */
-static struct wchan *minibolt;
+static volatile struct timepage *timepage;
 
-/* 
- * number of minibolts per second
- */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+void
+timepage_bootstrap(void)
+{
+	vaddr_t va;
+
+	va = alloc_kpages(1);
+	if (va == 0) {
+		panic("Couldn't allocate the time page\n");
+	}
+	bzero((void *)va, PAGE_SIZE);
+	timepage = (volatile struct timepage *)va;
+}
+
+paddr_t
+timepage_paddr(void)
+{
+	KASSERT(timepage != NULL);
+	return KVADDR_TO_PADDR((vaddr_t)timepage);
+}
 
 /*
- * minibolt countdown
+ * The time page is kept up to date by CPU 0's clock tick. While CPU 0
+ * is idle and not ticking, every other CPU's tick does it instead.
+ * Writers are serialized by timepage_lock; one that finds it taken
+ * just skips its update, since the page is being refreshed anyway.
  */
-static int minicount;
+static struct spinlock timepage_lock = SPINLOCK_INITIALIZER;
+static volatile bool timekeeper_idle;
 
 /*
- * Setup.
+ * Store the current time in the time page.
  */
+static
 void
-hardclock_bootstrap(void)
+timepage_update(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	time_t secs;
+	uint32_t nsecs;
+
+	if (timepage == NULL || !spinlock_tryacquire(&timepage_lock)) {
+		return;
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	gettime(&secs, &nsecs);
+	timepage->tp_gen++;
+	timepage->tp_secs = secs;
+	timepage->tp_nsecs = nsecs;
+	timepage->tp_gen++;
+	spinlock_release(&timepage_lock);
 }
 
 /*
- * This is called once every every LT_GRANULARITY usec, on one processor,
- * by the timer code.
+ * Tickless idle.
+ *
+ * An idle CPU has nothing for hardclock to do, except run callouts:
+ * there is no thread to charge for the tick and nothing queued to age
+ * or migrate. Taking the interrupt anyway costs every idle CPU hz
+ * interrupts a second, which adds up with many CPUs. So while idle,
+ * the tick timer is set for when the first callout on this CPU may be
+ * due, or as far out as it goes. Either that tick or whatever other
+ * interrupt comes first (usually an IPI because a thread was made
+ * runnable here) starts the regular tick again, and the skipped ticks
+ * are counted, both in c_ticks_skipped and in c_hardclocks so the
+ * hardclock-driven periods and callouts keep their pace.
  */
+static
+void
+hardclock_skipped(unsigned skipped)
+{
+	curcpu->c_tickless = false;
+	curcpu->c_hardclocks += skipped;
+	curcpu->c_ticks_skipped += skipped;
+}
+
+void
+hardclock_idle(void)
+{
+	unsigned nticks, when;
+
+	nticks = mainbus_timer_maxticks();
+	if (callout_nextevent(&when)) {
+		when -= curcpu->c_hardclocks;
+		if ((int)when <= 0) {
+			when = 1;
+		}
+		if (when < nticks) {
+			nticks = when;
+		}
+	}
+
+	curcpu->c_tickless = true;
+	curcpu->c_tickless_len = nticks;
+	if (curcpu->c_number == 0) {
+		timekeeper_idle = true;
+	}
+	mainbus_timer_set(nticks);
+}
+
 void
-timerclock(void)
+hardclock_wake(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	if (curcpu->c_tickless) {
+		/* woken by something else; the timer hasn't gone off */
+		hardclock_skipped(mainbus_timer_elapsed());
+		mainbus_timer_set(1);
+	}
+
+	if (curcpu->c_number == 0) {
+		timekeeper_idle = false;
+	}
+	if (timekeeper_idle || curcpu->c_number == 0) {
+		/* may have gone stale while everyone was idle */
+		timepage_update();
 	}
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
+ * This is called hz times a second (on each processor) by the timer
  * code.
  */
 void
@@ -119,14 +203,77 @@ hardclock(void)
 	 * Collect statistics here as desired.
 	 */
 
+	if (curcpu->c_tickless) {
+		/* the idle timer went off, and stood in for this many */
+		hardclock_skipped(curcpu->c_tickless_len - 1);
+	}
+
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0 || timekeeper_idle) {
+		timepage_update();
+	}
+	callout_hardclock();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	thread_timeslice();
+}
+
+/*
+ * clocksleep and clocknap: sleep on our own wait channel until a
+ * callout says the time is up, so nobody else is woken up.
+ *
+ * The callout sets cs_done and wakes us holding cs_lock, and we don't
+ * return before we have held it after that, so it is done with our
+ * stack frame by the time we leave.
+ */
+struct clocksleep {
+	struct spinlock cs_lock;
+	struct thread *cs_thread;
+	bool cs_done;
+};
+
+static
+void
+clocksleep_wakeup(void *data)
+{
+	struct clocksleep *cs = data;
+
+	spinlock_acquire(&cs->cs_lock);
+	cs->cs_done = true;
+	wchan_wakeone(cs->cs_thread->t_sleepchan);
+	spinlock_release(&cs->cs_lock);
+}
+
+static
+void
+clocksleep_ticks(unsigned nticks)
+{
+	struct clocksleep cs;
+	struct callout co;
+
+	if (nticks == 0) {
+		return;
+	}
+
+	spinlock_init(&cs.cs_lock);
+	cs.cs_thread = curthread;
+	cs.cs_done = false;
+	callout_init(&co, clocksleep_wakeup, &cs);
+
+	spinlock_acquire(&cs.cs_lock);
+	callout_schedule(&co, nticks);
+	while (!cs.cs_done) {
+		wchan_lock(curthread->t_sleepchan);
+		spinlock_release(&cs.cs_lock);
+		wchan_sleep(curthread->t_sleepchan);
+		spinlock_acquire(&cs.cs_lock);
+	}
+	spinlock_release(&cs.cs_lock);
+	spinlock_cleanup(&cs.cs_lock);
 }
 
 /*
@@ -135,23 +282,23 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
+  if (num_secs > 0) {
+    clocksleep_ticks(num_secs * hz);
   }
 }
 
 /*
  * Suspend execution for num_ticks timer ticks.
- *  (one tick every LT_GRANULARITY usec)
+ *  (one tick every LT_GRANULARITY usec, rounded up to whole hardclocks)
  */
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
+  unsigned usecs_per_hardclock;
+
+  if (num_ticks > 0) {
+    usecs_per_hardclock = 1000000 / hz;
+    clocksleep_ticks((num_ticks * LT_GRANULARITY + usecs_per_hardclock - 1)
+                     / usecs_per_hardclock);
   }
 }
@@ -110,6 +110,36 @@ spinlock_acquire(struct spinlock *lk)
 	lk->lk_holder = mycpu;
 }
 
+/*
+ * Get the lock only if nobody has it.
+ */
+bool
+spinlock_tryacquire(struct spinlock *lk)
+{
+	struct cpu *mycpu;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (lk->lk_holder == mycpu) {
+			panic("Deadlock on spinlock %p\n", lk);
+		}
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	if (spinlock_data_get(&lk->lk_lock) != 0 ||
+	    spinlock_data_testandset(&lk->lk_lock) != 0) {
+		spllower(IPL_HIGH, IPL_NONE);
+		return false;
+	}
+
+	lk->lk_holder = mycpu;
+	return true;
+}
+
 /*
  * Release the lock.
  */
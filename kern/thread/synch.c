@@ -211,6 +211,25 @@ lock_acquire(struct lock *lock)
     spinlock_release(&lock->lk_spin);
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+    bool got;
+
+    KASSERT(lock != NULL);
+    KASSERT(curthread->t_in_interrupt == false);
+    KASSERT(!lock_do_i_hold(lock));
+
+    spinlock_acquire(&lock->lk_spin);
+    got = !lock->held;
+    if (got) {
+        lock->held = 1;
+        lock->cur_thread = curthread;
+    }
+    spinlock_release(&lock->lk_spin);
+    return got;
+}
+
 void
 lock_release(struct lock *lock)
 {
@@ -35,6 +35,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/syscallstat.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
@@ -49,9 +50,12 @@
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
+#include <clock.h>
+#include <callout.h>
 #include <vnode.h>
 
 #include "opt-synchprobs.h"
+#include "opt-A3.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -133,6 +137,12 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
+	thread->t_sleepchan = wchan_create("clocksleep");
+	if (thread->t_sleepchan == NULL) {
+		kfree(thread->t_name);
+		kfree(thread);
+		return NULL;
+	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
@@ -143,6 +153,9 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_prio = 0;
+	thread->t_ticks = 0;
+	thread->t_affinity = CPUMASK_ALL;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -167,6 +180,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -179,20 +193,48 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_departing);
 	c->c_hardclocks = 0;
+	c->c_ticks_skipped = 0;
+	c->c_tickless = false;
+	c->c_tickless_len = 0;
+	c->c_callouts = callout_createwheel(c->c_hardclocks);
+	if (c->c_callouts == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_steals = 0;
+	c->c_stealfails = 0;
+	c->c_syscallstats = kmalloc(SCSTAT_NCALLS * sizeof(struct syscallstat));
+	if (c->c_syscallstats == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	bzero(c->c_syscallstats, SCSTAT_NCALLS * sizeof(struct syscallstat));
+#if OPT_A3
+	/* older than any generation; the first as_activate flushes */
+	c->c_asid_gen = 0;
+	c->c_asid = 0;
+	c->c_tlb_next = 0;
+#endif
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	/* affinity masks have one bit per cpu */
+	KASSERT(c->c_number < 32);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -258,6 +300,7 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
+	wchan_destroy(thread->t_sleepchan);
 	kfree(thread->t_name);
 	kfree(thread);
 }
@@ -289,6 +332,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -303,9 +348,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,31 +474,296 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+void
+cpu_syscallstats(struct syscallstat *sum)
+{
+	const struct syscallstat *s;
+	unsigned i, j, k;
+
+	bzero(sum, SCSTAT_NCALLS * sizeof(struct syscallstat));
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		s = cpuarray_get(&allcpus, i)->c_syscallstats;
+		for (j=0; j<SCSTAT_NCALLS; j++) {
+			sum[j].ss_count += s[j].ss_count;
+			sum[j].ss_errors += s[j].ss_errors;
+			for (k=0; k<SCSTAT_NBUCKETS; k++) {
+				sum[j].ss_hist[k] += s[j].ss_hist[k];
+			}
+		}
+	}
+}
+
+/*
+ * Run queues.
+ *
+ * Each cpu has one run queue per scheduling level. A thread is queued
+ * at the level in its t_prio, and the highest level (lowest number)
+ * with anything on it runs first. All of these need the cpu's
+ * runqueue lock.
+ */
+
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_prio < SCHED_NLEVELS);
+	threadlist_addtail(&c->c_runqueue[t->t_prio], t);
+	c->c_runcount++;
+}
+
+/*
+ * Take the next thread to run: the head of the highest level.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * True if T's affinity mask lets it run on C.
+ */
+static
+bool
+thread_cpuok(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & CPUMASK(c->c_number)) != 0;
+}
+
+/*
+ * Take the thread that would run last, searching from the tail of the
+ * lowest level, to move it to another cpu. If DEST isn't NULL, skip
+ * threads whose affinity doesn't allow DEST.
+ *
+ * Ordinarily, c_curthread will not appear on the run queue. However,
+ * it can under the following circumstances:
+ *   - it went to sleep;
+ *   - the processor became idle, so it remained c_curthread;
+ *   - it was reawakened, so it was put on the run queue;
+ *   - and the processor hasn't fully unidled yet, so all these
+ *     things are still true.
+ * Moving it in that state would have two cpus on one stack, so it is
+ * skipped too.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c, struct cpu *dest)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=SCHED_NLEVELS; i-- > 0; ) {
+		THREADLIST_FORALL_REV(t, c->c_runqueue[i]) {
+			if (t == c->c_curthread) {
+				continue;
+			}
+			if (dest != NULL && !thread_cpuok(t, dest)) {
+				continue;
+			}
+			threadlist_remove(&c->c_runqueue[i], t);
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The highest level with a thread queued, or SCHED_NLEVELS if none.
+ */
+static
+unsigned
+runqueue_toplevel(struct cpu *c)
+{
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Work stealing.
+ *
+ * Called by an idle cpu, holding its own runqueue lock, to take a
+ * thread off the end of the busiest other cpu's run queues. Threads
+ * whose affinity doesn't include this cpu are left alone. The other
+ * cpu's lock is only tried, never waited for: that keeps idle cpus
+ * from piling up on a busy one's lock, and since we already hold our
+ * own it also means two cpus stealing from each other can't deadlock.
+ * A failed try is counted and we go back to idling; the next
+ * interrupt will bring us back here.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	/* Pick a victim without locking; this is only a hint. */
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		if (c->c_runcount > most) {
+			most = c->c_runcount;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	if (!spinlock_tryacquire(&victim->c_runqueue_lock)) {
+		curcpu->c_stealfails++;
+		return NULL;
+	}
+	t = runqueue_remtail(victim, curcpu->c_self);
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t != NULL) {
+		t->t_cpu = curcpu->c_self;
+		curcpu->c_steals++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	return t;
+}
+
+/*
+ * Choose a cpu for a thread that is becoming runnable. Caches are
+ * likely still warm on the cpu it last ran on, so stay there unless
+ * it has AFFINITY_BACKLOG or more threads queued and some other cpu
+ * the thread may use has less work. Loads are read without locking;
+ * they only need to be roughly right.
+ */
+#define AFFINITY_BACKLOG	2
+
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *last, *c, *best;
+	unsigned i, numcpus, load, bestload;
+
+	last = t->t_cpu;
+	if (thread_cpuok(t, last) &&
+	    (last->c_isidle || last->c_runcount < AFFINITY_BACKLOG)) {
+		return last;
+	}
+
+	/* an idle cpu counts as load 0, a busy one as 1 + its queue */
+	best = NULL;
+	bestload = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_cpuok(t, c)) {
+			continue;
+		}
+		load = c->c_isidle ? 0 : c->c_runcount + 1;
+		if (best == NULL || load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+
+	if (best == NULL ||
+	    (thread_cpuok(t, last) && last->c_runcount + 1 <= bestload)) {
+		return last;
+	}
+	return best;
+}
+
+/*
+ * A thread with affinity MASK was just queued on BUSY, which is
+ * running something else. An idle cpu takes no clock ticks and so
+ * won't come looking for work by itself; wake up one in MASK, so it
+ * can steal.
+ */
+static
+void
+thread_kickidle(uint32_t mask, struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c->c_isidle &&
+		    (mask & CPUMASK(c->c_number)) != 0) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * targetcpu might be curcpu; it might not be, too. If the caller
+ * already holds the runqueue lock, the thread goes on its own cpu;
+ * otherwise thread_pickcpu chooses.
  */
 static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
+	uint32_t affinity;
 	bool isidle;
 
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
-
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
+		targetcpu = target->t_cpu;
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
+		targetcpu = thread_pickcpu(target);
+		if (targetcpu != target->t_cpu) {
+			/*
+			 * If it was woken before its old cpu finished
+			 * switching away from it, that cpu is still on its
+			 * stack (see runqueue_remtail) and it has to stay.
+			 * Once we hold the old cpu's runqueue lock, any
+			 * switch in progress there is done.
+			 */
+			spinlock_acquire(&target->t_cpu->c_runqueue_lock);
+			if (target->t_cpu->c_curthread == target) {
+				targetcpu = target->t_cpu;
+			}
+			spinlock_release(&target->t_cpu->c_runqueue_lock);
+			target->t_cpu = targetcpu;
+		}
+
+		/* Lock the run queue of the target thread's cpu. */
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	affinity = target->t_affinity;
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -461,6 +774,10 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
+		if (!isidle) {
+			/* after unlocking, so the steal can succeed */
+			thread_kickidle(affinity, targetcpu);
+		}
 	}
 }
 
@@ -506,6 +823,7 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -534,6 +852,33 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Requeue threads that yielded on a cpu their affinity mask no longer
+ * allows. Like zombies, they are parked per-cpu by thread_switch and
+ * handled here once they are no longer on this cpu's stack.
+ */
+static
+void
+depart(void)
+{
+	struct threadlist list;
+	struct thread *t;
+
+	threadlist_init(&list);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&curcpu->c_departing)) != NULL) {
+		threadlist_addtail(&list, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	while ((t = threadlist_remhead(&list)) != NULL) {
+		KASSERT(t != curthread);
+		KASSERT(t->t_state == S_READY);
+		thread_make_runnable(t, false);
+	}
+	threadlist_cleanup(&list);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -574,7 +919,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && curcpu->c_runcount == 0 &&
+	    thread_cpuok(cur, curcpu)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -585,7 +931,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (thread_cpuok(cur, curcpu)) {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
+		else {
+			/* moved elsewhere by depart() after the switch */
+			threadlist_addtail(&curcpu->c_departing, cur);
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
@@ -627,15 +979,24 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before idling, try to take work from another cpu. Idle cpus
+	 * don't take clock ticks, so busy cpus wake one up when they
+	 * queue work (thread_kickidle) to give it another try.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
+		if (next == NULL) {
+			next = thread_steal();
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+			hardclock_idle();
 			cpu_idle();
+			hardclock_wake();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -714,6 +1075,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send off threads that may not run here. */
+	depart();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -747,6 +1111,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send off threads that may not run here. */
+	depart();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -822,17 +1189,153 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Threads start at level 0. A
+ * thread at level L gets a quantum of SCHED_QUANTUM(L) hardclocks;
+ * if it uses all of it, it drops a level, so CPU hogs sink and get
+ * longer but rarer turns. A thread woken from a wait channel rises a
+ * level, so threads that mostly wait for I/O stay near the top and
+ * run soon after their I/O completes. A running thread is preempted
+ * at the next tick if a thread at a higher level becomes runnable.
+ *
+ * So that nothing starves, schedule(), called periodically from
+ * hardclock(), moves every queued thread on the current cpu up one
+ * level.
  */
 
+#define SCHED_QUANTUM(level)	(1U << (level))
+
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	unsigned i;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			t->t_prio = i - 1;
+			threadlist_addtail(&curcpu->c_runqueue[i - 1], t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+void
+thread_timeslice(void)
+{
+	struct thread *cur;
+	bool yield;
+
+	cur = curthread;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (curcpu->c_isidle) {
+		/* the idle loop isn't charged for anything */
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_prio)) {
+		if (cur->t_prio < SCHED_NLEVELS - 1) {
+			cur->t_prio++;
+		}
+		cur->t_ticks = 0;
+		yield = true;
+	}
+	else {
+		yield = runqueue_toplevel(curcpu) < cur->t_prio;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (yield) {
+		thread_yield();
+	}
+}
+
+/*
+ * A thread is being woken up: move it up a level and give it a fresh
+ * quantum. Nobody else can get at a thread between its removal from
+ * the wait channel and thread_make_runnable, so no lock is needed.
+ */
+static
+void
+thread_wakeboost(struct thread *t)
+{
+	if (t->t_prio > 0) {
+		t->t_prio--;
+	}
+	t->t_ticks = 0;
+}
+
+void
+thread_printticks(void)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%u: %u ticks, %u skipped while idle\n",
+			c->c_number, c->c_hardclocks - c->c_ticks_skipped,
+			c->c_ticks_skipped);
+	}
+}
+
+int
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	unsigned i, numcpus;
+	uint32_t online;
+
+	online = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		online |= CPUMASK(cpuarray_get(&allcpus, i)->c_number);
+	}
+	if ((mask & online) == 0) {
+		return EINVAL;
+	}
+
+	t->t_affinity = mask;
+	if (t == curthread && !thread_cpuok(t, curcpu)) {
+		/* thread_switch sends us somewhere allowed */
+		thread_yield();
+	}
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(struct thread *t)
+{
+	return t->t_affinity;
+}
+
+void
+thread_printrunqueues(void)
+{
+	unsigned counts[SCHED_NLEVELS];
+	unsigned i, j, numcpus, total;
+	struct cpu *c;
+
+	kprintf("Run queue occupancy, level 0 first:\n");
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		for (j=0; j<SCHED_NLEVELS; j++) {
+			counts[j] = c->c_runqueue[j].tl_count;
+		}
+		total = c->c_runcount;
+		spinlock_release(&c->c_runqueue_lock);
+
+		kprintf("cpu%u:", c->c_number);
+		for (j=0; j<SCHED_NLEVELS; j++) {
+			kprintf(" %3u", counts[j]);
+		}
+		kprintf("   (%u queued, %u stolen, %u steals failed)\n",
+			total, c->c_steals, c->c_stealfails);
+	}
 }
 
 /*
@@ -866,9 +1369,9 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += c->c_runcount;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_runcount;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -882,9 +1385,14 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		/* this skips curthread; see runqueue_remtail */
+		t = runqueue_remtail(curcpu, NULL);
+		if (t == NULL) {
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
+	to_send = i;
 	spinlock_release(&curcpu->c_runqueue_lock);
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
@@ -893,38 +1401,22 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (c->c_runcount < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
+			 * If its affinity doesn't allow this cpu, shuffle
+			 * it to the end of the list and decrement to_send
+			 * in order to skip it. Then it goes back on our
+			 * own run queue below.
 			 */
-			if (t == curthread) {
+			if (!thread_cpuok(t, c)) {
 				threadlist_addtail(&victims, t);
 				to_send--;
 				continue;
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1440,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1050,6 +1542,7 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
+	thread_wakeboost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1084,6 +1577,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeboost(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1140,26 +1634,88 @@ ipi_broadcast(int code)
 	}
 }
 
-void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+/*
+ * Queue N shootdowns on TARGET behind a single IPI. Returns the
+ * sequence number TARGET will have finished once they are done.
+ */
+static
+unsigned
+ipi_tlbshootdown_queue(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned n)
 {
-	int n;
+	unsigned i, seq;
+	int m;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	for (i=0; i<n; i++) {
+		m = target->c_numshootdown;
+		if (m == TLBSHOOTDOWN_ALL) {
+			/* already flushing everything */
+			break;
+		}
+		if (m == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+			break;
+		}
+		target->c_shootdown[m] = mappings[i];
+		target->c_numshootdown = m+1;
 	}
+	seq = ++target->c_shootdown_seq;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+	return seq;
+}
+
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	ipi_tlbshootdown_queue(target, mapping, 1);
+}
+
+void
+ipi_tlbshootdown_sync(uint32_t cpumask,
+		      const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned seq[32];
+	uint32_t queued;
+	unsigned i, num, done;
+	struct cpu *c;
+
+	/* we have to be able to take other cpus' shootdowns meanwhile */
+	KASSERT(curthread->t_curspl == 0);
+
+	num = cpuarray_num(&allcpus);
+	KASSERT(num <= 32);
+
+	/*
+	 * We may change cpus at any point here, so don't look at curcpu:
+	 * the caller has already left out the cpu it did itself. If we
+	 * end up on a cpu in the mask, it takes its own IPI.
+	 */
+	queued = 0;
+	for (i=0; i<num; i++) {
+		if (cpumask & ((uint32_t)1 << i)) {
+			c = cpuarray_get(&allcpus, i);
+			seq[i] = ipi_tlbshootdown_queue(c, mappings, n);
+			queued |= (uint32_t)1 << i;
+		}
+	}
+
+	for (i=0; i<num; i++) {
+		if (!(queued & ((uint32_t)1 << i))) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+		do {
+			spinlock_acquire(&c->c_ipi_lock);
+			done = c->c_shootdown_done;
+			spinlock_release(&c->c_ipi_lock);
+		} while ((int)(done - seq[i]) < 0);
+	}
 }
 
 void
@@ -1202,6 +1758,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_seq;
 	}
 
 	curcpu->c_ipi_pending = 0;
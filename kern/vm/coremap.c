@@ -0,0 +1,449 @@
+/*
+ * Physical page allocator (coremap).
+ *
+ * The memory left over after the kernel image and the early
+ * ram_stealmem allocations is managed as a binary buddy system. Every
+ * free block is a power-of-two run of frames aligned to its own size,
+ * kept on a per-order doubly linked free list threaded through the
+ * coremap entries themselves, so no extra memory is needed.
+ *
+ * Allocating npages rounds up to the next order, splits larger blocks
+ * on the way down and then hands the unused tail of the block straight
+ * back, so a 3-page request costs 3 frames, not 4. Freeing looks up the
+ * frame index directly from the physical address and merges with free
+ * buddies on the way up. Both are O(log n) in the number of frames.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+
+#include "opt-A3.h"
+
+#if OPT_A3
+
+/*
+ * Free lists, one per order. An order-k block is 2^k frames.
+ */
+#define COREMAP_NORDERS 16
+#define NO_FRAME (-1)
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct coremap *coremap_table;
+static paddr_t coremap_base;		/* physical address of frame 0 */
+static int frame_num;			/* number of managed frames */
+static int free_frames;			/* frames currently on free lists */
+static int free_list[COREMAP_NORDERS];
+static int free_count[COREMAP_NORDERS];
+
+static
+void
+freelist_push(int frame, unsigned order)
+{
+	struct coremap *cm = &coremap_table[frame];
+
+	cm->available = true;
+	cm->order = order;
+	cm->prev_free = NO_FRAME;
+	cm->next_free = free_list[order];
+	if (free_list[order] != NO_FRAME) {
+		coremap_table[free_list[order]].prev_free = frame;
+	}
+	free_list[order] = frame;
+	free_count[order]++;
+}
+
+static
+void
+freelist_remove(int frame)
+{
+	struct coremap *cm = &coremap_table[frame];
+
+	KASSERT(cm->available);
+	if (cm->prev_free != NO_FRAME) {
+		coremap_table[cm->prev_free].next_free = cm->next_free;
+	}
+	else {
+		free_list[cm->order] = cm->next_free;
+	}
+	if (cm->next_free != NO_FRAME) {
+		coremap_table[cm->next_free].prev_free = cm->prev_free;
+	}
+	free_count[cm->order]--;
+	cm->available = false;
+}
+
+/*
+ * Put one aligned order-k block back, merging with its buddy for as
+ * long as the buddy is itself a free block of the same order.
+ */
+static
+void
+buddy_free_block(int frame, unsigned order)
+{
+	int buddy;
+
+	KASSERT((frame & ((1 << order) - 1)) == 0);
+
+	while (order + 1 < COREMAP_NORDERS) {
+		buddy = frame ^ (1 << order);
+		if (buddy + (1 << order) > frame_num ||
+		    !coremap_table[buddy].available ||
+		    coremap_table[buddy].order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < frame) {
+			frame = buddy;
+		}
+		order++;
+	}
+	freelist_push(frame, order);
+}
+
+/*
+ * Free an arbitrary run of frames by carving it into the largest
+ * aligned blocks that fit.
+ */
+static
+void
+buddy_free_range(int frame, int npages)
+{
+	unsigned order;
+
+	free_frames += npages;
+	while (npages > 0) {
+		order = 0;
+		while (order + 1 < COREMAP_NORDERS &&
+		       (frame & ((1 << (order + 1)) - 1)) == 0 &&
+		       (1 << (order + 1)) <= npages) {
+			order++;
+		}
+		buddy_free_block(frame, order);
+		frame += 1 << order;
+		npages -= 1 << order;
+	}
+}
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	int i;
+
+	/* lo is first physical addr. hi is last */
+	ram_getsize(&lo, &hi);
+
+	/* the coremap itself lives at the bottom of the managed region */
+	frame_num = (hi - lo) / PAGE_SIZE;
+	coremap_table = (struct coremap *)PADDR_TO_KVADDR(lo);
+	coremap_base = ROUNDUP(lo + frame_num * sizeof(struct coremap),
+			       PAGE_SIZE);
+	frame_num = (hi - coremap_base) / PAGE_SIZE;
+	DEBUG(DB_MEMORY, "coremap: %d frames from 0x%x\n",
+	      frame_num, coremap_base);
+
+	for (i=0; i<COREMAP_NORDERS; i++) {
+		free_list[i] = NO_FRAME;
+		free_count[i] = 0;
+	}
+	for (i=0; i<frame_num; i++) {
+		coremap_table[i].available = false;
+		coremap_table[i].order = 0;
+		coremap_table[i].contiguous_frame_num = 0;
+		coremap_table[i].refcount = 0;
+		coremap_table[i].owner = NULL;
+		coremap_table[i].owner_vaddr = 0;
+		coremap_table[i].referenced = false;
+		coremap_table[i].busy = false;
+		coremap_table[i].next_free = NO_FRAME;
+		coremap_table[i].prev_free = NO_FRAME;
+	}
+	free_frames = 0;
+	buddy_free_range(0, frame_num);
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	unsigned order, k;
+	int frame;
+
+	KASSERT(npages > 0);
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (order >= COREMAP_NORDERS) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	for (k = order; k < COREMAP_NORDERS; k++) {
+		if (free_list[k] != NO_FRAME) {
+			break;
+		}
+	}
+	if (k == COREMAP_NORDERS) {
+		spinlock_release(&coremap_lock);
+		DEBUG(DB_MEMORY, "coremap: no block for %lu pages\n", npages);
+		return 0;
+	}
+
+	frame = free_list[k];
+	freelist_remove(frame);
+	free_frames -= 1 << k;
+
+	/* split down, putting the upper halves back */
+	while (k > order) {
+		k--;
+		freelist_push(frame + (1 << k), k);
+		free_frames += 1 << k;
+	}
+
+	/* return the unused tail of the block */
+	if (npages < (1UL << order)) {
+		buddy_free_range(frame + npages, (1 << order) - npages);
+	}
+
+	coremap_table[frame].contiguous_frame_num = npages;
+	coremap_table[frame].refcount = 1;
+
+	spinlock_release(&coremap_lock);
+
+	return coremap_base + frame * PAGE_SIZE;
+}
+
+static
+int
+paddr_to_frame(paddr_t paddr)
+{
+	int frame;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(paddr >= coremap_base);
+	frame = (paddr - coremap_base) / PAGE_SIZE;
+	KASSERT(frame < frame_num);
+	return frame;
+}
+
+/* Release a block; coremap_lock must be held. */
+static
+void
+coremap_release(int frame)
+{
+	int npages;
+
+	KASSERT(!coremap_table[frame].available);
+	npages = coremap_table[frame].contiguous_frame_num;
+	KASSERT(npages > 0);
+	coremap_table[frame].contiguous_frame_num = 0;
+	coremap_table[frame].refcount = 0;
+	coremap_table[frame].owner = NULL;
+	coremap_table[frame].referenced = false;
+	coremap_table[frame].busy = false;
+	buddy_free_range(frame, npages);
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	int frame;
+
+	if (paddr < coremap_base) {
+		/* stolen before the coremap existed; nothing to give back */
+		return;
+	}
+	frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_release(frame);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Reference counts for user frames shared copy-on-write between
+ * address spaces. A frame is freed when the last mapping drops it.
+ */
+void
+coremap_incref(paddr_t paddr)
+{
+	int frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_table[frame].refcount > 0);
+	coremap_table[frame].refcount++;
+	/* shared frames are never paged out */
+	coremap_table[frame].owner = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_decref(paddr_t paddr)
+{
+	int frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_table[frame].refcount > 0);
+	coremap_table[frame].refcount--;
+	/* whoever is left claims it again in coremap_touch */
+	coremap_table[frame].owner = NULL;
+	if (coremap_table[frame].refcount == 0) {
+		coremap_release(frame);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	int frame = paddr_to_frame(paddr);
+	unsigned refcount;
+
+	spinlock_acquire(&coremap_lock);
+	refcount = coremap_table[frame].refcount;
+	spinlock_release(&coremap_lock);
+	return refcount;
+}
+
+/*
+ * Record the single address space mapping a freshly filled user page.
+ */
+void
+coremap_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	int frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_table[frame].refcount == 1);
+	coremap_table[frame].owner = as;
+	coremap_table[frame].owner_vaddr = vaddr;
+	coremap_table[frame].referenced = true;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Called when a page is loaded into the TLB. Sets the reference bit
+ * the clock looks at, and lets the last remaining user of a formerly
+ * shared frame take ownership of it so it can be paged out again.
+ */
+void
+coremap_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	int frame = paddr_to_frame(paddr);
+	struct coremap *cm = &coremap_table[frame];
+
+	cm->referenced = true;
+	if (cm->owner != NULL) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	if (cm->owner == NULL && cm->refcount == 1 && !cm->busy) {
+		cm->owner = as;
+		cm->owner_vaddr = vaddr;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Second-chance clock over the coremap. Picks up to MAX single-frame
+ * user pages that are mapped by exactly one address space and have
+ * not been referenced since the hand last went by, marks them busy and
+ * returns their addresses. At most two sweeps are made, so a frame
+ * that was referenced gets exactly one second chance.
+ */
+static int clock_hand;
+
+int
+coremap_clock_victims(paddr_t *victims, int max)
+{
+	struct coremap *cm;
+	int n, steps;
+
+	n = 0;
+	spinlock_acquire(&coremap_lock);
+	for (steps = 0; steps < 2 * frame_num && n < max; steps++) {
+		cm = &coremap_table[clock_hand];
+		if (cm->available || cm->contiguous_frame_num != 1 ||
+		    cm->refcount != 1 || cm->owner == NULL || cm->busy) {
+			/* free, kernel, shared or already going */
+		}
+		else if (cm->referenced) {
+			cm->referenced = false;
+		}
+		else {
+			cm->busy = true;
+			victims[n++] = coremap_base + clock_hand * PAGE_SIZE;
+		}
+		clock_hand = (clock_hand + 1) % frame_num;
+	}
+	spinlock_release(&coremap_lock);
+	return n;
+}
+
+/* Page-out of this frame was abandoned; make it eligible again. */
+void
+coremap_unbusy(paddr_t paddr)
+{
+	int frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_table[frame].busy);
+	coremap_table[frame].busy = false;
+	spinlock_release(&coremap_lock);
+}
+
+struct addrspace *
+coremap_owner(paddr_t paddr, vaddr_t *vaddr)
+{
+	int frame = paddr_to_frame(paddr);
+	struct addrspace *as;
+
+	spinlock_acquire(&coremap_lock);
+	as = coremap_table[frame].owner;
+	*vaddr = coremap_table[frame].owner_vaddr;
+	spinlock_release(&coremap_lock);
+	return as;
+}
+
+/*
+ * Fragmentation report for the kh menu command. The "external
+ * fragmentation" figure is the share of free memory that is not in
+ * the single largest free block, i.e. unusable for one big request.
+ */
+void
+coremap_printstats(void)
+{
+	int counts[COREMAP_NORDERS];
+	int total, largest, i;
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<COREMAP_NORDERS; i++) {
+		counts[i] = free_count[i];
+	}
+	total = free_frames;
+	spinlock_release(&coremap_lock);
+
+	largest = 0;
+	kprintf("Coremap status: %d of %d frames free\n", total, frame_num);
+	for (i=0; i<COREMAP_NORDERS; i++) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		kprintf("   order %2d (%5d pages): %d free blocks\n",
+			i, 1 << i, counts[i]);
+		largest = 1 << i;
+	}
+	if (total > 0) {
+		kprintf("   largest free block %d pages, "
+			"external fragmentation %d%%\n",
+			largest, 100 - (largest * 100) / total);
+	}
+}
+
+#endif /* OPT_A3 */
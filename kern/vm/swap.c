@@ -0,0 +1,326 @@
+/*
+ * Swap space and page replacement.
+ *
+ * User pages are paged out to the raw second disk (lhd1). The disk is
+ * divided into page-sized slots; each slot has a reference count so a
+ * swapped-out page can stay shared between a parent and child after
+ * fork, just as resident pages are shared copy-on-write.
+ *
+ * When the coremap runs dry, swap_evict runs the clock in coremap.c to
+ * pick up to SWAP_CLUSTER cold pages, unmaps them from their owners,
+ * and writes them out to consecutive slots with a single disk request.
+ * All but one of the frames are freed; the last is handed to the
+ * caller. Page-out and page-in are serialized by swap_lock, which is
+ * also what keeps an owning address space from being destroyed while
+ * one of its pages is on the way out.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <uw-vmstats.h>
+
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#define SWAP_DEVICE  "lhd1raw:"
+#define SWAP_CLUSTER 8			/* pages written per disk request */
+
+static struct vnode *swap_vnode;	/* NULL if there is no swap disk */
+static struct lock *swap_lock;
+
+static struct spinlock swap_slot_lock = SPINLOCK_INITIALIZER;
+static uint16_t *swap_refcount;		/* one per slot, 0 if free */
+static unsigned swap_nslots;
+static unsigned swap_hint;		/* where the next search starts */
+static unsigned swap_used;
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	char path[sizeof(SWAP_DEVICE)];
+	int result;
+
+	swap_lock = lock_create("swap");
+	if (swap_lock == NULL) {
+		panic("swap_bootstrap: out of memory\n");
+	}
+
+	/* vfs_open may scribble on the path */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: cannot open %s: %s; paging disabled\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat %s: %s\n", SWAP_DEVICE, strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+
+	swap_refcount = kmalloc(swap_nslots * sizeof(uint16_t));
+	if (swap_refcount == NULL) {
+		panic("swap_bootstrap: out of memory\n");
+	}
+	bzero(swap_refcount, swap_nslots * sizeof(uint16_t));
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+void
+swap_lock_acquire(void)
+{
+	lock_acquire(swap_lock);
+}
+
+void
+swap_lock_release(void)
+{
+	lock_release(swap_lock);
+}
+
+/*
+ * Find NSLOTS free consecutive slots and take a reference on each.
+ * Returns the first slot, or -1 if there is no such run.
+ */
+static
+int
+swap_alloc_run(unsigned nslots)
+{
+	unsigned i, start, run, scanned;
+
+	spinlock_acquire(&swap_slot_lock);
+	run = 0;
+	start = swap_hint;
+	i = swap_hint;
+	for (scanned = 0; scanned < swap_nslots + nslots; scanned++) {
+		if (i == swap_nslots) {
+			/* runs don't wrap around the end of the disk */
+			i = 0;
+			run = 0;
+		}
+		if (swap_refcount[i] != 0) {
+			run = 0;
+		}
+		else {
+			if (run == 0) {
+				start = i;
+			}
+			run++;
+			if (run == nslots) {
+				for (i = start; i < start + nslots; i++) {
+					swap_refcount[i] = 1;
+				}
+				swap_used += nslots;
+				swap_hint = (start + nslots) % swap_nslots;
+				spinlock_release(&swap_slot_lock);
+				return start;
+			}
+		}
+		i++;
+	}
+	spinlock_release(&swap_slot_lock);
+	return -1;
+}
+
+void
+swap_incref(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_slot_lock);
+	KASSERT(swap_refcount[slot] > 0);
+	KASSERT(swap_refcount[slot] < 0xffff);
+	swap_refcount[slot]++;
+	spinlock_release(&swap_slot_lock);
+}
+
+void
+swap_decref(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_slot_lock);
+	KASSERT(swap_refcount[slot] > 0);
+	swap_refcount[slot]--;
+	if (swap_refcount[slot] == 0) {
+		swap_used--;
+	}
+	spinlock_release(&swap_slot_lock);
+}
+
+/*
+ * Read the page in SLOT into the frame at PADDR.
+ */
+int
+swap_read(unsigned slot, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	return 0;
+}
+
+/*
+ * Write the N frames in PADDRS to the consecutive slots starting at
+ * SLOT in one request.
+ */
+static
+void
+swap_write_cluster(unsigned slot, paddr_t *paddrs, int n)
+{
+	struct iovec iov[SWAP_CLUSTER];
+	struct uio ku;
+	int i, result;
+
+	for (i=0; i<n; i++) {
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)slot * PAGE_SIZE;
+	ku.uio_resid = n * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+
+	result = VOP_WRITE(swap_vnode, &ku);
+	if (result) {
+		/* the pages are already unmapped; there is no going back */
+		panic("swap: write to slot %u failed: %s\n",
+		      slot, strerror(result));
+	}
+	KASSERT(ku.uio_resid == 0);
+
+	for (i=0; i<n; i++) {
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	}
+}
+
+/*
+ * Free up memory by paging out a cluster of cold user pages. Returns
+ * one of the frames, now unowned, for the caller to use, or 0 if
+ * nothing could be evicted.
+ */
+paddr_t
+swap_evict(void)
+{
+	paddr_t victims[SWAP_CLUSTER];
+	struct tlbshootdown ts[SWAP_CLUSTER];
+	uint32_t cpus;
+	struct addrspace *as;
+	vaddr_t vaddr;
+	bool dolock;
+	int n, kept, i, first;
+
+	if (swap_vnode == NULL) {
+		return 0;
+	}
+
+	/* page-in comes here with the lock already held */
+	dolock = !lock_do_i_hold(swap_lock);
+	if (dolock) {
+		lock_acquire(swap_lock);
+	}
+
+	n = coremap_clock_victims(victims, SWAP_CLUSTER);
+	if (n == 0) {
+		/* everything resident is kernel memory or shared */
+		if (dolock) {
+			lock_release(swap_lock);
+		}
+		return 0;
+	}
+
+	/* the slots come first so a full disk leaves the pages alone */
+	first = -1;
+	while (n > 0) {
+		first = swap_alloc_run(n);
+		if (first >= 0) {
+			break;
+		}
+		coremap_unbusy(victims[--n]);
+	}
+	if (n == 0) {
+		if (dolock) {
+			lock_release(swap_lock);
+		}
+		kprintf("swap: out of swap space (%u of %u slots in use)\n",
+			swap_used, swap_nslots);
+		return 0;
+	}
+
+	/*
+	 * Unmap each page. The owner may have shared or dropped it since
+	 * the clock looked; such pages stay put and their slots go back.
+	 */
+	kept = 0;
+	cpus = 0;
+	for (i=0; i<n; i++) {
+		as = coremap_owner(victims[i], &vaddr);
+		if (as == NULL ||
+		    as_page_out(as, vaddr, victims[i], first + kept,
+				&ts[kept], &cpus)) {
+			coremap_unbusy(victims[i]);
+			continue;
+		}
+		victims[kept++] = victims[i];
+	}
+	for (i=kept; i<n; i++) {
+		swap_decref(first + i);
+	}
+
+	if (kept == 0) {
+		if (dolock) {
+			lock_release(swap_lock);
+		}
+		return 0;
+	}
+
+	/* nobody may still be writing to the frames while they go out */
+	vm_tlbshootdown_batch(cpus, ts, kept);
+	swap_write_cluster(first, victims, kept);
+
+	for (i=1; i<kept; i++) {
+		coremap_decref(victims[i]);
+	}
+	coremap_set_owner(victims[0], NULL, 0);
+	coremap_unbusy(victims[0]);
+
+	if (dolock) {
+		lock_release(swap_lock);
+	}
+	return victims[0];
+}
+
+#endif /* OPT_A3 */
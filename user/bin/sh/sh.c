@@ -292,6 +292,41 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * forkexec
+ * runs args[0] in a child made with fork and execv.  returns the child's
+ * pid, or -1 if the fork failed.
+ */
+static
+pid_t
+forkexec(char **args)
+{
+	pid_t pid;
+
+	pid = fork();
+	switch (pid) {
+		case -1:
+			/* error */
+			warn("fork");
+			break;
+		case 0:
+			/* child */
+			execv(args[0], args);
+			warn("%s", args[0]);
+			/*
+			 * Use _exit() instead of exit() in the child
+			 * process to avoid calling atexit() functions,
+			 * which would cause hostcompat (if present) to
+			 * reset the tty state and mess up our input
+			 * handling.
+			 */
+			_exit(1);
+		default:
+			break;
+	}
+	return pid;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
@@ -354,26 +389,22 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+#ifndef HOST
+	/* spawn doesn't copy the shell only to throw the copy away */
+	pid = spawn(args[0], args);
+	if (pid < 0 && errno != ENOSYS) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(1);
+	}
+	if (pid < 0) {
+		/* kernel without spawn */
+		pid = forkexec(args);
+	}
+#else
+	pid = forkexec(args);
+#endif
+	if (pid < 0) {
+		return _MKWAIT_EXIT(255);
 	}
 
 	/* parent */
@@ -404,6 +435,39 @@ docommand(char *buf)
 	return status;
 }
 
+#ifndef HOST
+/*
+ * getcmd
+ * reads a line from the console, which does the echoing and editing
+ * itself, so each command costs one read. the newline is dropped, as
+ * is anything past the end of the buffer.
+ */
+static
+void
+getcmd(char *buf, size_t len)
+{
+	char junk[64];
+	int n;
+
+	fflush(stdout);
+	n = read(STDIN_FILENO, buf, len-1);
+	if (n <= 0) {
+		/* error, or ^D: treat as an empty command */
+		buf[0] = 0;
+		return;
+	}
+	if (buf[n-1] == '\n') {
+		buf[n-1] = 0;
+		return;
+	}
+	buf[n] = 0;
+
+	/* discard the rest of an overlong line */
+	do {
+		n = read(STDIN_FILENO, junk, sizeof(junk));
+	} while (n > 0 && junk[n-1] != '\n');
+}
+#else
 /*
  * getcmd
  * pulls valid characters off the console, filling the buffer.  
@@ -449,6 +513,7 @@ getcmd(char *buf, size_t len)
 	}
 	buf[pos] = 0;
 }	
+#endif /* HOST */
 
 /*
  * interactive
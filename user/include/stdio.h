@@ -41,6 +41,35 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/* Default buffer size for streams */
+#define BUFSIZ 1024
+
+/*
+ * Buffered output streams. Only the three standard streams exist.
+ *
+ * stdout is line-buffered if it goes to the console (anything that
+ * can't seek) and fully buffered otherwise; stderr is unbuffered.
+ * exit() flushes everything, as does reading from stdin.
+ */
+typedef struct __file {
+	int f_fd;		/* file descriptor */
+	int f_flags;		/* __F_* below */
+	char *f_buf;		/* buffer, or NULL if unbuffered */
+	size_t f_size;		/* size of f_buf */
+	size_t f_len;		/* bytes in f_buf waiting to be written */
+} FILE;
+
+/* f_flags (for libc internal use only) */
+#define __F_UNBUF    1	/* write everything straight through */
+#define __F_LINEBUF  2	/* flush at every newline */
+#define __F_MODESET  4	/* buffering mode has been decided */
+#define __F_ERR      8	/* a write failed */
+
+extern FILE __stdin, __stdout, __stderr;
+#define stdin  (&__stdin)
+#define stdout (&__stdout)
+#define stderr (&__stderr)
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -69,4 +98,8 @@ int putchar(int);
 /* Reads one character (0-255) or returns EOF on error. */
 int getchar(void);
 
+/* Buffered output. fflush(NULL) flushes every stream. */
+size_t fwrite(const void *ptr, size_t size, size_t nitems, FILE *f);
+int fflush(FILE *f);
+
 #endif /* _STDIO_H_ */
@@ -157,6 +157,16 @@ int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
+/* OS/161 extensions. */
+pid_t spawn(const char *prog, char *const *args);	/* fork+execv */
+struct syscallstat;					/* <kern/syscallstat.h> */
+int syscallstats(struct syscallstat *stats, size_t nstats);
+struct asyncring;					/* <kern/asyncring.h> */
+int asyncsetup(struct asyncring *ring);
+int asyncsubmit(void);
+int setaffinity(pid_t pid, unsigned cpumask);	/* bit N: may run on cpu N */
+int getaffinity(pid_t pid, unsigned *cpumask);
+
 /*
  * These are not themselves system calls, but wrapper routines in libc.
  */
@@ -0,0 +1,12 @@
+/*
+ * The standard streams.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+static char __stdout_buf[BUFSIZ];
+
+FILE __stdin = { STDIN_FILENO, __F_UNBUF | __F_MODESET, NULL, 0, 0 };
+FILE __stdout = { STDOUT_FILENO, 0, __stdout_buf, sizeof(__stdout_buf), 0 };
+FILE __stderr = { STDERR_FILENO, __F_UNBUF | __F_MODESET, NULL, 0, 0 };
@@ -0,0 +1,32 @@
+/*
+ * C standard I/O function - write out a stream's buffer.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+int
+fflush(FILE *f)
+{
+	size_t done;
+	int len;
+
+	if (f == NULL) {
+		/* stdin and stderr never hold anything */
+		return fflush(stdout);
+	}
+
+	done = 0;
+	while (done < f->f_len) {
+		len = write(f->f_fd, f->f_buf + done, f->f_len - done);
+		if (len <= 0) {
+			/* drop what's left rather than retry forever */
+			f->f_flags |= __F_ERR;
+			f->f_len = 0;
+			return EOF;
+		}
+		done += len;
+	}
+	f->f_len = 0;
+	return 0;
+}
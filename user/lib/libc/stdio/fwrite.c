@@ -0,0 +1,110 @@
+/*
+ * C standard I/O function - buffered write.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Pick the buffering mode the first time a stream is written: line
+ * buffering for the console, which is the only thing here that can't
+ * seek, and full buffering for files.
+ */
+static
+void
+__fsetmode(FILE *f)
+{
+	if (lseek(f->f_fd, 0, SEEK_CUR) < 0) {
+		f->f_flags |= __F_LINEBUF;
+	}
+	f->f_flags |= __F_MODESET;
+}
+
+/*
+ * Write LEN bytes straight to the file.
+ */
+static
+int
+__fwriteout(FILE *f, const char *data, size_t len)
+{
+	int r;
+
+	while (len > 0) {
+		r = write(f->f_fd, data, len);
+		if (r <= 0) {
+			f->f_flags |= __F_ERR;
+			return EOF;
+		}
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Does DATA contain a newline?
+ */
+static
+int
+__hasnewline(const char *data, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (data[i] == '\n') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+size_t
+fwrite(const void *ptr, size_t size, size_t nitems, FILE *f)
+{
+	const char *data = ptr;
+	size_t len, chunk;
+	int flush;
+
+	len = size * nitems;
+	if (len == 0) {
+		return 0;
+	}
+	if (!(f->f_flags & __F_MODESET)) {
+		__fsetmode(f);
+	}
+
+	if (f->f_flags & __F_UNBUF) {
+		return __fwriteout(f, data, len) ? 0 : nitems;
+	}
+
+	/* on a line-buffered stream, anything up to a newline goes now */
+	flush = (f->f_flags & __F_LINEBUF) && __hasnewline(data, len);
+
+	/* too big to be worth copying: write it behind what's buffered */
+	if (len >= f->f_size) {
+		if (fflush(f) || __fwriteout(f, data, len)) {
+			return 0;
+		}
+		return nitems;
+	}
+
+	while (len > 0) {
+		if (f->f_len == f->f_size && fflush(f)) {
+			return 0;
+		}
+		chunk = f->f_size - f->f_len;
+		if (chunk > len) {
+			chunk = len;
+		}
+		memcpy(f->f_buf + f->f_len, data, chunk);
+		f->f_len += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+
+	if (flush && fflush(f)) {
+		return 0;
+	}
+	return nitems;
+}
@@ -19,8 +19,17 @@ awk '
 	# print the name of the call and the number.
 	print $2, $3;
     }
-' | awk '{
+' | awk '
+    # Calls that libc wraps in C get their stub under another name,
+    # for the wrapper to call.
+    BEGIN { wrapped["__time"] = 1; wrapped["fork"] = 1; }
+    {
 	# output something simple that will work in syscalls.S.
-	printf "SYSCALL(%s, %s)\n", $1, $2;
-}'
+	if ($1 in wrapped) {
+	    printf "WRAPPEDSYSCALL(%s, %s)\n", $1, $2;
+	}
+	else {
+	    printf "SYSCALL(%s, %s)\n", $1, $2;
+	}
+    }'
     
@@ -0,0 +1,38 @@
+#include <unistd.h>
+#include <kern/timepage.h>
+
+/* the real system call; see syscalls-mips.S */
+time_t _sys__time(time_t *seconds, unsigned long *nanoseconds);
+
+/*
+ * OS/161 function: get the time of day, in seconds and nanoseconds.
+ *
+ * This reads the kernel's time page (see <kern/timepage.h>), which costs no
+ * system call. If the kernel was updating it at the time, just make
+ * the system call rather than spin.
+ */
+time_t
+__time(time_t *seconds, unsigned long *nanoseconds)
+{
+	volatile const struct timepage *tp;
+	time_t secs;
+	unsigned long nsecs;
+	unsigned gen;
+
+	tp = (volatile const struct timepage *)TIMEPAGE_VADDR;
+	gen = tp->tp_gen;
+	if ((gen & 1) == 0) {
+		secs = tp->tp_secs;
+		nsecs = tp->tp_nsecs;
+		if (tp->tp_gen == gen) {
+			if (seconds != NULL) {
+				*seconds = secs;
+			}
+			if (nanoseconds != NULL) {
+				*nanoseconds = nsecs;
+			}
+			return secs;
+		}
+	}
+	return _sys__time(seconds, nanoseconds);
+}
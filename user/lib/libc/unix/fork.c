@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <unistd.h>
+
+/* the real system call; see syscalls-mips.S */
+pid_t _sysfork(void);
+
+/*
+ * POSIX C function: make a copy of the current process.
+ *
+ * Buffered stdio output would be copied into the child and written out
+ * twice, once by each process, so flush it first.
+ */
+pid_t
+fork(void)
+{
+	fflush(NULL);
+	return _sysfork();
+}
@@ -0,0 +1,151 @@
+/*
+ * asyncbench - compare small writes made one system call at a time
+ * with the same writes queued on the batched-syscall ring.
+ *
+ * Usage: asyncbench [nwrites]
+ *
+ * The writes go to null: so that what is measured is the cost of
+ * getting in and out of the kernel, not of the device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <kern/asyncring.h>
+
+#define DEFAULT_NWRITES 20000
+#define WRITESIZE 16
+
+static char buf[WRITESIZE];
+static struct asyncring ring;
+
+static
+unsigned long
+elapsed_usecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	if (ns1 < ns0) {
+		ns1 += 1000000000;
+		s1--;
+	}
+	return (unsigned long)(s1 - s0) * 1000000 + (ns1 - ns0) / 1000;
+}
+
+static
+void
+report(const char *what, int nwrites, unsigned long usecs)
+{
+	unsigned long per;
+
+	/* hundredths of a microsecond per write */
+	per = usecs * 100 / nwrites;
+	printf("%s: %d writes in %lu.%06lu seconds, %lu.%02lu us each\n",
+	       what, nwrites, usecs / 1000000, usecs % 1000000,
+	       per / 100, per % 100);
+}
+
+/*
+ * One write() per write.
+ */
+static
+unsigned long
+bench_syscall(int fd, int nwrites)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	int i;
+
+	__time(&s0, &ns0);
+	for (i=0; i<nwrites; i++) {
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			err(1, "write");
+		}
+	}
+	__time(&s1, &ns1);
+	return elapsed_usecs(s0, ns0, s1, ns1);
+}
+
+/*
+ * Fill the ring, submit it all in one call, and reap the completions.
+ */
+static
+unsigned long
+bench_ring(int fd, int nwrites)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	struct asyncsqe *sqe;
+	struct asynccqe *cqe;
+	int queued, reaped;
+
+	if (asyncsetup(&ring)) {
+		err(1, "asyncsetup");
+	}
+
+	__time(&s0, &ns0);
+	queued = reaped = 0;
+	while (reaped < nwrites) {
+		while (queued < nwrites &&
+		       ring.ar_sqtail - ring.ar_cqhead < ASYNC_NENTRIES) {
+			sqe = &ring.ar_sq[ring.ar_sqtail % ASYNC_NENTRIES];
+			sqe->sqe_op = ASYNC_WRITE;
+			sqe->sqe_fd = fd;
+			sqe->sqe_buf = buf;
+			sqe->sqe_len = sizeof(buf);
+			sqe->sqe_tag = queued++;
+			ring.ar_sqtail++;
+		}
+		if (asyncsubmit() < 0) {
+			err(1, "asyncsubmit");
+		}
+		while (ring.ar_cqhead != ring.ar_cqtail) {
+			cqe = &ring.ar_cq[ring.ar_cqhead % ASYNC_NENTRIES];
+			if (cqe->cqe_result != sizeof(buf)) {
+				errno = cqe->cqe_errno;
+				err(1, "write %u (queued)", cqe->cqe_tag);
+			}
+			ring.ar_cqhead++;
+			reaped++;
+		}
+	}
+	__time(&s1, &ns1);
+
+	asyncsetup(NULL);
+	return elapsed_usecs(s0, ns0, s1, ns1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nwrites = DEFAULT_NWRITES;
+	unsigned long t_sys, t_ring;
+	int fd;
+
+	if (argc > 1) {
+		nwrites = atoi(argv[1]);
+		if (nwrites <= 0) {
+			errx(1, "Usage: %s [nwrites]", argv[0]);
+		}
+	}
+
+	memset(buf, 'x', sizeof(buf));
+	fd = open("null:", O_WRONLY);
+	if (fd < 0) {
+		err(1, "null:");
+	}
+
+	t_sys = bench_syscall(fd, nwrites);
+	t_ring = bench_ring(fd, nwrites);
+	close(fd);
+
+	report("write()", nwrites, t_sys);
+	report("ring", nwrites, t_ring);
+	if (t_ring > 0) {
+		printf("speedup: %lu.%02lux\n", t_sys / t_ring,
+		       (t_sys * 100 / t_ring) % 100);
+	}
+	return 0;
+}
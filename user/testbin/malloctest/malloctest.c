@@ -65,25 +65,16 @@ geti(void)
 	int val=0;
 	int ch, digits=0;
 
+	/* the console echoes and handles backspace for us */
 	while (1) {
 		ch = getchar();
-		if (ch=='\n' || ch=='\r') {
-			putchar('\n');
+		if (ch=='\n' || ch==EOF) {
 			break;
 		}
-		else if ((ch=='\b' || ch==127) && digits>0) {
-			printf("\b \b");
-			val = val/10;
-			digits--;
-		}
 		else if (ch>='0' && ch<='9') {
-			putchar(ch);
 			val = val*10 + (ch-'0');
 			digits++;
 		}
-		else {
-			putchar('\a');
-		}
 	}
 
 	if (digits==0) {